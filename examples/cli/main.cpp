@@ -0,0 +1,406 @@
+#include "hidapi.h"
+#include "hidclock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Headless monitor and load tool. Run without arguments for usage. */
+
+struct Options
+{
+    std::string command;
+    //! "vid:pid" in hex or part of the device path, empty for all devices, or the simulated ones with sim
+    std::string device;
+    std::string file;
+    double rate = 100.0;
+    unsigned long count = 0;
+    bool quiet = false;
+    //! Report ID to monitor, -1 for all
+    int reportId = -1;
+    //! Number of simulated echo devices to add
+    unsigned int sim = 0;
+    //! Input report rate of each simulated device
+    double simRate = 1000.0;
+};
+
+/* Per-device counters updated by the read loops */
+struct Stream
+{
+    HidDevice *device;
+    std::atomic<unsigned long long> reports {0};
+    unsigned long long last = 0;
+};
+
+static std::atomic<bool> s_stop(false);
+static std::mutex s_outMutex;
+
+static BOOL WINAPI ctrlHandler(DWORD)
+{
+    s_stop = true;
+    return TRUE;
+}
+
+static void usage()
+{
+    std::cerr <<
+        "usage: yaha_cli <command> [options]\n"
+        "commands:\n"
+        "  list                      list devices with attributes and usages\n"
+        "  monitor                   stream reports with rate and drop statistics\n"
+        "  inject                    write output reports from a file at a fixed rate\n"
+        "  probe                     measure round-trip latency of an echoing device\n"
+        "options:\n"
+        "  --device VID:PID|PATH     select devices (default: all for monitor, first for others)\n"
+        "  --file FILE               hex output reports, one per line (inject)\n"
+        "  --rate HZ                 reports per second (inject, default 100)\n"
+        "  --count N                 stop after N reports or probes (default: until Ctrl+C, 1000 probes)\n"
+        "  --quiet                   statistics only, no report lines (monitor)\n"
+        "  --report-id ID            only count and show reports with this report ID (monitor)\n"
+        "  --sim N                   add N simulated echo devices and use only them unless --device is given\n"
+        "  --sim-rate HZ             input reports per second of each simulated device (default 1000)\n";
+}
+
+static bool parse(int ac, char **av, Options &o)
+{
+    if (ac < 2)
+        return false;
+    o.command = av[1];
+    for (int i = 2; i < ac; i++) {
+        std::string a = av[i];
+        bool hasValue = i + 1 < ac;
+        if (a == "--device" && hasValue)
+            o.device = av[++i];
+        else if (a == "--file" && hasValue)
+            o.file = av[++i];
+        else if (a == "--rate" && hasValue)
+            o.rate = atof(av[++i]);
+        else if (a == "--count" && hasValue)
+            o.count = strtoul(av[++i], nullptr, 10);
+        else if (a == "--quiet")
+            o.quiet = true;
+        else if (a == "--report-id" && hasValue)
+            o.reportId = int(strtoul(av[++i], nullptr, 0)) & 0xff;
+        else if (a == "--sim" && hasValue)
+            o.sim = unsigned(strtoul(av[++i], nullptr, 10));
+        else if (a == "--sim-rate" && hasValue)
+            o.simRate = atof(av[++i]);
+        else
+            return false;
+    }
+    return o.command == "list" || o.command == "monitor" || o.command == "inject" || o.command == "probe";
+}
+
+static std::string narrow(const std::wstring &w)
+{
+    std::string s;
+    for (wchar_t c : w)
+        s.push_back(c < 0x80 ? char(c) : '?');
+    return s;
+}
+
+static bool matches(HidDevice *d, const std::string &filter)
+{
+    if (filter.empty())
+        return true;
+    unsigned int vid, pid;
+    if (sscanf(filter.c_str(), "%x:%x", &vid, &pid) == 2)
+        return d->getVid() == vid && d->getPid() == pid;
+    return narrow(d->getPath()).find(filter) != std::string::npos;
+}
+
+static std::wstring simPath(unsigned int i)
+{
+    return L"sim:echo" + std::to_wstring(i);
+}
+
+static std::vector<HidDevice*> select(HidApi &api, const Options &o)
+{
+    std::vector<HidDevice*> selected;
+    /* With --sim alone only the simulated devices, not whatever is plugged in */
+    if (o.sim && o.device.empty()) {
+        for (unsigned int i = 0; i < o.sim; i++) {
+            HidDevice *d = api.getHidDevice(simPath(i));
+            if (d && d->isConnected())
+                selected.push_back(d);
+        }
+        return selected;
+    }
+    std::shared_ptr<const HidDeviceMap> devices = api.devices();
+    for (auto &x : *devices)
+        if (x.second->isConnected() && matches(x.second.get(), o.device))
+            selected.push_back(x.second.get());
+    return selected;
+}
+
+static bool parseHex(const std::string &line, std::vector<unsigned char> &report)
+{
+    report.clear();
+    int hi = -1;
+    for (char c : line) {
+        int v;
+        if (c >= '0' && c <= '9')
+            v = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            v = c - 'A' + 10;
+        else if (c == ' ' || c == '\t' || c == ',' || c == '\r')
+            continue;
+        else if (c == '#')
+            break;
+        else
+            return false;
+        if (hi < 0) {
+            hi = v;
+        } else {
+            report.push_back((unsigned char)(hi << 4 | v));
+            hi = -1;
+        }
+    }
+    return hi < 0 && !report.empty();
+}
+
+/* Add simulated echo devices fed with input reports by a generator thread */
+static std::thread simulate(HidApi &api, const Options &o, std::vector<std::shared_ptr<SimulatedDevice>> &sims)
+{
+    api.setHotplugDebounce(0);
+    for (unsigned int i = 0; i < o.sim; i++) {
+        std::shared_ptr<SimulatedDevice> sim = std::make_shared<SimulatedDevice>(simPath(i), 65, 65);
+        sim->setAttributes(0x1209, 0x0001 + i);
+        sim->setStrings(L"Yaha", L"Simulated echo device", std::to_wstring(i));
+        sim->setUsage(0xff00, 0x01);
+        sim->setEcho(true, 100);
+        sims.push_back(sim);
+        api.addSimulatedDevice(sim);
+    }
+
+    /* Arrivals are handled by the hotplug workers, real devices may already be listed */
+    for (auto &sim : sims) {
+        for (int tries = 0; tries < 100; tries++) {
+            HidDevice *d = api.getHidDevice(sim->getPath());
+            if (d && d->isConnected())
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    if (o.simRate <= 0)
+        return std::thread();
+    return std::thread([&sims, o]() {
+        std::chrono::nanoseconds period(uint64_t(1e9 / o.simRate));
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        unsigned char report[65] = {0};
+        for (unsigned long n = 0; !s_stop; n++) {
+            /* A counter and a slowly moving value, like a sensor */
+            report[1] = (unsigned char)n;
+            report[2] = (unsigned char)(n >> 8);
+            report[3] = (unsigned char)(n / 64);
+            for (auto &s : sims)
+                s->inject(report, sizeof(report));
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    });
+}
+
+static int list(HidApi &api, const Options &o)
+{
+    for (HidDevice *d : select(api, o)) {
+        char ids[64];
+        snprintf(ids, sizeof(ids), "%04x:%04x v%04x usage %04x:%04x in %3u out %3u",
+                 d->getVid(), d->getPid(), d->getVersionNumber(), d->getUsagePage(), d->getUsage(),
+                 unsigned(d->getInputReportLength()), unsigned(d->getOutputReportLength()));
+        std::cout << ids << "  " << narrow(d->getManufacturer()) << " " << narrow(d->getProduct());
+        if (!d->getSerialNumber().empty())
+            std::cout << " (" << narrow(d->getSerialNumber()) << ")";
+        std::cout << "\n    " << narrow(d->getPath()) << "\n";
+    }
+    return 0;
+}
+
+static int monitor(HidApi &api, const Options &o)
+{
+    std::vector<HidDevice*> devices = select(api, o);
+    if (devices.empty()) {
+        std::cerr << "no matching device\n";
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::atomic<unsigned long long> total(0);
+    for (HidDevice *d : devices) {
+        if (!d->open()) {
+            std::cerr << "cannot open " << narrow(d->getPath()) << "\n";
+            continue;
+        }
+        streams.emplace_back(new Stream());
+        Stream *s = streams.back().get();
+        s->device = d;
+
+        d->setCallbackReport([s, &o, &total](HidDevice *d, const unsigned char *report, size_t length) {
+            s->reports++;
+            total++;
+            if (o.quiet)
+                return;
+            std::vector<char> line(ReportFormatter::lineSize(length, nullptr));
+            size_t n = ReportFormatter::line(HidClock::now(), d->getVid(), d->getPid(),
+                                             report, length, FormatHex, nullptr, line.data());
+            std::lock_guard<std::mutex> lock(s_outMutex);
+            fwrite(line.data(), 1, n, stdout);
+        });
+        /* Keep slow terminals from stalling the read loops, and count what is lost */
+        d->setQueueDepth(4096);
+        d->setOverflowPolicy(OverflowPolicy::DropOldest);
+        if (o.reportId >= 0)
+            d->setReportFilter(ReportPredicate().reportId((unsigned char)o.reportId));
+        d->setReadBlocking(false);
+        d->setReadContinuous(true);
+        d->read();
+    }
+
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (!s_stop && (!o.count || total < o.count)) {
+        next += std::chrono::seconds(1);
+        while (!s_stop && std::chrono::steady_clock::now() < next && (!o.count || total < o.count))
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        std::lock_guard<std::mutex> lock(s_outMutex);
+        for (auto &s : streams) {
+            unsigned long long n = s->reports;
+            fprintf(stderr, "%04x:%04x %8llu reports/s %10llu total %8llu dropped %8llu suppressed %8llu filtered\n",
+                    s->device->getVid(), s->device->getPid(), n - s->last, n,
+                    s->device->getDroppedReports(), s->device->getSuppressedReports(),
+                    s->device->getFilteredReports());
+            s->last = n;
+        }
+    }
+
+    for (auto &s : streams) {
+        s->device->setReadContinuous(false);
+        s->device->close();
+    }
+    return 0;
+}
+
+static int inject(HidApi &api, const Options &o)
+{
+    std::vector<HidDevice*> devices = select(api, o);
+    if (devices.empty() || o.file.empty() || o.rate <= 0) {
+        std::cerr << (devices.empty() ? "no matching device\n" : "need --file and a positive --rate\n");
+        return 1;
+    }
+    HidDevice *d = devices.front();
+
+    std::ifstream in(o.file.c_str());
+    std::vector<std::vector<unsigned char>> reports;
+    std::string line;
+    std::vector<unsigned char> report;
+    while (std::getline(in, line))
+        if (parseHex(line, report))
+            reports.push_back(report);
+    if (reports.empty()) {
+        std::cerr << "no reports in " << o.file << "\n";
+        return 1;
+    }
+    if (!d->open()) {
+        std::cerr << "cannot open " << narrow(d->getPath()) << "\n";
+        return 1;
+    }
+
+    /* Paced by absolute deadlines so that the rate does not drift */
+    std::chrono::nanoseconds period(uint64_t(1e9 / o.rate));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next = start;
+    unsigned long long sent = 0, failed = 0, late = 0;
+    for (unsigned long i = 0; !s_stop && (!o.count || i < o.count); i++) {
+        const std::vector<unsigned char> &r = reports[i % reports.size()];
+        if (d->submitWrite(r.data(), r.size()) && d->waitSubmitted(TIMEOUT))
+            sent++;
+        else
+            failed++;
+
+        next += period;
+        if (std::chrono::steady_clock::now() > next)
+            late++;
+        else
+            std::this_thread::sleep_until(next);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%llu sent, %llu failed, %llu late, %.1f reports/s\n",
+            sent, failed, late, seconds > 0 ? sent / seconds : 0.0);
+    d->close();
+    return failed ? 1 : 0;
+}
+
+static int probe(HidApi &api, const Options &o)
+{
+    std::vector<HidDevice*> devices = select(api, o);
+    if (devices.empty()) {
+        std::cerr << "no matching device\n";
+        return 1;
+    }
+    HidDevice *d = devices.front();
+    if (!d->open()) {
+        std::cerr << "cannot open " << narrow(d->getPath()) << "\n";
+        return 1;
+    }
+    d->setReadBlocking(false);
+    d->setReadContinuous(true);
+    d->read();
+
+    RoundTripProbe p;
+    std::vector<unsigned char> report(d->getOutputReportLength(), 0);
+    p.setReport(report.data(), report.size());
+    bool ok = p.run(*d, o.count ? o.count : 1000);
+
+    const LatencyHistogram &h = p.histogram();
+    fprintf(stderr, "%llu round trips, %llu timeouts\n", h.count(), p.timeouts());
+    fprintf(stderr, "min %.1f us  p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+            h.min() / 1e3, h.percentile(50) / 1e3, h.percentile(99) / 1e3,
+            h.percentile(99.9) / 1e3, h.max() / 1e3);
+
+    d->setReadContinuous(false);
+    d->close();
+    return ok ? 0 : 1;
+}
+
+int main(int ac, char **av)
+{
+    Options o;
+    if (!parse(ac, av, o)) {
+        usage();
+        return 2;
+    }
+    SetConsoleCtrlHandler(ctrlHandler, TRUE);
+
+    HidApi api;
+    std::vector<std::shared_ptr<SimulatedDevice>> sims;
+    std::thread generator;
+    if (o.sim)
+        generator = simulate(api, o, sims);
+
+    int res = 0;
+    if (o.command == "list")
+        res = list(api, o);
+    else if (o.command == "monitor")
+        res = monitor(api, o);
+    else if (o.command == "inject")
+        res = inject(api, o);
+    else if (o.command == "probe")
+        res = probe(api, o);
+
+    s_stop = true;
+    if (generator.joinable())
+        generator.join();
+    return res;
+}
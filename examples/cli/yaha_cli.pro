@@ -0,0 +1,15 @@
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle qt
+
+TARGET = yaha_cli
+TEMPLATE = app
+
+include(../../yaha.pri)
+
+SOURCES += main.cpp
+INCLUDEPATH += ../../include
+
+QMAKE_TARGET_COMPANY = undersampled bananas
+QMAKE_TARGET_PRODUCT = Yaha command line tool
+QMAKE_TARGET_DESCRIPTION = "Yaha command line tool"
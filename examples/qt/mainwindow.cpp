@@ -4,8 +4,7 @@
 #include "device.h"
 #include "hidapi.h"
 #include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <vector>
 
 #include <QMessageBox>
 
@@ -26,6 +25,8 @@ MainWindow::MainWindow(QWidget *parent) :
     m_hid.setCallbackArrival([this](HidDevice* d){return arrivalCallback(d);});
     m_hid.setCallbackRemoval([this](HidDevice* d){return removalCallback(d);});
     connect(this, SIGNAL(readCallbackSignal(HidDevice*)), this, SLOT(readCallbackSlot(HidDevice*)));
+    connect(this, SIGNAL(arrivalSignal(HidDevice*)), this, SLOT(arrivalSlot(HidDevice*)));
+    connect(this, SIGNAL(removalSignal(HidDevice*)), this, SLOT(removalSlot(HidDevice*)));
     connect(ui->treeWidget, SIGNAL(itemClicked(QTreeWidgetItem*,int)), this, SLOT(setDevice(QTreeWidgetItem*,int)));
     connect(ui->lineEdit, SIGNAL(returnPressed()), this, SLOT(sendData()));
     connect(ui->lineEdit, SIGNAL(textChanged(QString)), this, SLOT(dataChanged(QString)));
@@ -44,16 +45,17 @@ MainWindow::~MainWindow()
 void MainWindow::refresh()
 {
     ui->treeWidget->clear();
-    for(auto &x : m_hid.m_devices)
+    auto devices = m_hid.devices();
+    for(auto &x : *devices)
         if((x.second)->isConnected()) {
             Device *device = new Device(QString::fromStdWString((x.second)->getProduct()),
                                         QString::number((x.second)->getVid(), 16).toUpper().rightJustified(4, '0'),
                                         QString::number((x.second)->getPid(), 16).toUpper().rightJustified(4, '0'),
                                         QString::fromStdWString((x.second)->getSerialNumber()),
-                                        (x.second));
+                                        (x.second).get());
             ui->treeWidget->insertTopLevelItem(0, device);
 
-            if (x.second == m_d)
+            if (x.second.get() == m_d)
                 ui->treeWidget->setCurrentItem(device);
         }
     return;
@@ -61,6 +63,8 @@ void MainWindow::refresh()
 
 void MainWindow::setDevice(QTreeWidgetItem* item, int column)
 {
+    if (m_d != nullptr)
+        m_d->setAutoReconnect(false);
     if (m_d != nullptr && m_d->isOpen()) {
         m_d->setCallbackReadComplete(nullptr);
         m_d->setReadContinuous(false);
@@ -72,6 +76,7 @@ void MainWindow::setDevice(QTreeWidgetItem* item, int column)
         m_d->setWriteBlocking(true);
         m_d->setReadBlocking(false);
         m_d->setReadContinuous(true);
+        m_d->setAutoReconnect(true);
         m_d->read();
     }
 }
@@ -139,19 +144,23 @@ void MainWindow::setLength(int length)
 
 void MainWindow::arrivalCallback(HidDevice *d)
 {
-    /* If the selected device has been connected after disconnection then reopen it */
-    if (m_d == d && m_d != nullptr && m_d->open()) {
-        m_d->setCallbackReadComplete([this](HidDevice* d){return readCallback(d);});
-        m_d->setWriteBlocking(true);
-        m_d->setReadBlocking(false);
-        m_d->setReadContinuous(true);
-        m_d->read();
-    }
+    // Hotplug callbacks run on a library thread
+    emit arrivalSignal(d);
+}
+
+void MainWindow::removalCallback(HidDevice *d)
+{
+    emit removalSignal(d);
+}
+
+void MainWindow::arrivalSlot(HidDevice *d)
+{
+    /* The selected device reopens itself after reconnection */
     refresh();
     return;
 }
 
-void MainWindow::removalCallback(HidDevice *d)
+void MainWindow::removalSlot(HidDevice *d)
 {
     refresh();
     return;
@@ -166,12 +175,13 @@ void MainWindow::readCallback(HidDevice *d)
 
 void MainWindow::readCallbackSlot(HidDevice *d)
 {
-    std::ostringstream os;
 //    if (d->m_readBuf == nullptr)
 //        return;
-    for(auto i = 1; i < m_length; i++)
-        os << std::hex << std::setw(2) << std::setfill('0') <<  (unsigned int)((d->m_readBuf)[i]) << " ";
-    ui->plainTextEdit->appendPlainText(QString::fromStdString(os.str()));
+    if(m_length < 2)
+        return;
+    std::vector<char> text(ReportFormatter::hexSize(m_length - 1));
+    size_t n = ReportFormatter::hex(d->m_readBuf + 1, m_length - 1, text.data());
+    ui->plainTextEdit->appendPlainText(QString::fromLatin1(text.data(), int(n)));
     return;
 }
 
@@ -24,6 +24,8 @@ public:
 
 public slots:
     void readCallbackSlot(HidDevice*);
+    void arrivalSlot(HidDevice*);
+    void removalSlot(HidDevice*);
     void refresh();
     void setDevice(QTreeWidgetItem*,int);
     void sendData();
@@ -37,6 +39,8 @@ private slots:
 
 signals:
     void readCallbackSignal(HidDevice*);
+    void arrivalSignal(HidDevice*);
+    void removalSignal(HidDevice*);
 
 private:
     Ui::MainWindow *ui;
@@ -6,7 +6,8 @@ using namespace std;
 int main(int ac, char** av)
 {
 	HidApi m_hid;
-	for (auto &x : m_hid.m_devices)
+	auto devices = m_hid.devices();
+	for (auto &x : *devices)
 		wcout << (x.second)->getProduct() << endl;
 
 	char c = getchar();
@@ -0,0 +1,110 @@
+#ifndef CALLBACKEXECUTOR_H
+#define CALLBACKEXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class HidDevice;
+
+//! CallbackExecutor class
+/*!
+ * Runs report callbacks of many devices on a fixed set of worker threads
+ * (shards), one per core by default, instead of on each device's read thread.
+ * Every device is bound to one shard, so its reports are handled in order and
+ * stay in that core's caches. Reports of devices marked order-insensitive may
+ * additionally be stolen by idle shards when their own shard falls behind.
+ */
+
+class CallbackExecutor
+{
+    public:
+        //! Starts the shard threads
+        /*!
+         * \param shards    Number of shards, 0 (default) uses one per hardware thread
+         * \param pin       true - pin shard i to CPU i, false - let the scheduler place them (default)
+         */
+        CallbackExecutor(unsigned int shards = 0, bool pin = false);
+        //! Stops the shard threads, reports still queued are discarded
+        ~CallbackExecutor();
+
+        //! Number of shards
+        unsigned int shards() const {return unsigned(m_shards.size());}
+        //! Pick a shard for a new device, spreading devices round-robin
+        unsigned int assign();
+
+        //! Queue a report for HidDevice::deliverReport() on a shard
+        /*!
+         * \param device        Device the report belongs to
+         * \param shard         Shard the device is bound to
+         * \param report        Report data, copied
+         * \param length        Number of bytes in report
+         * \param stealable     true - another shard may run it out of order
+         */
+        void post(HidDevice *device, unsigned int shard, const unsigned char *report,
+                  size_t length, bool stealable);
+        //! Discard queued reports of a device and wait for its running callbacks
+        /*!
+         * Must be called before the device stops reading for good. A callback
+         * draining its own device only discards, it cannot wait for itself.
+         * \param device    Device to drain
+         */
+        void drain(HidDevice *device);
+
+        //! Number of reports run by a shard, stolen ones included
+        unsigned long long executed(unsigned int shard);
+        //! Number of reports a shard stole from other shards
+        unsigned long long stolen(unsigned int shard);
+        //! Number of reports waiting on a shard
+        size_t pending(unsigned int shard);
+
+    private:
+        struct Task
+        {
+            HidDevice *device;
+            std::vector<unsigned char> report;
+            bool stealable;
+        };
+        struct Shard
+        {
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable idle;
+            std::deque<Task> tasks;
+            //! Emptied report buffers kept for reuse
+            std::vector<std::vector<unsigned char>> spare;
+            //! Device whose callback is running on this shard's thread
+            HidDevice *running = nullptr;
+            std::thread thread;
+            unsigned long long executed = 0;
+            unsigned long long stolen = 0;
+        };
+
+        //! Shard thread
+        void run(unsigned int index);
+        //! Take the newest stealable report queued on another shard
+        /*!
+         * \param thief     Index of the stealing shard
+         * \param task      Receives the report
+         * \return          False if there was nothing to steal
+         */
+        bool steal(unsigned int thief, Task &task);
+        //! Wake the next shard so that it tries to steal
+        void wakeNeighbour(unsigned int shard);
+        //! Run one report taken by shard runner and keep its buffer for reuse
+        void execute(unsigned int runner, Task &task, bool stolen);
+
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        //! Number of stealable reports queued on all shards
+        std::atomic<size_t> m_stealable {0};
+        std::atomic<unsigned int> m_next {0};
+        std::atomic<bool> m_stop {false};
+        bool m_pin;
+};
+
+#endif // CALLBACKEXECUTOR_H
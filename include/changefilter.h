@@ -0,0 +1,60 @@
+#ifndef CHANGEFILTER_H
+#define CHANGEFILTER_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+//! ChangeFilter class
+/*!
+ * Compares every report with the previous report of the same report ID and
+ * tells whether anything the consumer cares about changed. Bits set in the
+ * ignore mask (counters, timestamps) are left out of the comparison.
+ * Only the read loop compares, but the mask may be replaced from any thread.
+ */
+
+class ChangeFilter
+{
+    public:
+        //! Prepares storage for reports of at most reportLength bytes
+        /*!
+         * \param reportLength  Maximum report length
+         * \param ignoreMask    Bits to ignore, byte i applies to report byte i, may be shorter than the report
+         */
+        ChangeFilter(size_t reportLength, const std::vector<unsigned char> &ignoreMask);
+
+        //! Compare a report with the previous one of its report ID and remember it
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         * \return          True if the report differs or is the first of its ID
+         */
+        bool changed(const unsigned char *report, size_t length);
+        //! Bits that differed in the last report passed to changed(), ignored bits are zero
+        /*!
+         * All bits are set for the first report of a report ID.
+         */
+        const unsigned char *changedBits() const {return m_diff.data();}
+        //! Replace the ignore mask, keeping the previous reports
+        /*!
+         * Safe while another thread calls changed(), which picks up the new
+         * mask with its next report.
+         */
+        void setIgnoreMask(const std::vector<unsigned char> &ignoreMask);
+
+    private:
+        //! XOR of the report and previous one masked by care, returns true if not all zero
+        bool diff(const unsigned char *a, const unsigned char *b, const unsigned char *care, size_t length);
+
+        size_t m_reportLength;
+        //! Inverted ignore mask padded to m_reportLength, only replaced through std::atomic_store
+        std::shared_ptr<const std::vector<unsigned char>> m_care;
+        //! Previous report of each report ID, 256 slots of m_reportLength bytes
+        std::vector<unsigned char> m_last;
+        //! Length of the previous report of each report ID, 0 if none yet
+        std::vector<size_t> m_lastLength;
+        //! Changed bits of the last compared report
+        std::vector<unsigned char> m_diff;
+};
+
+#endif // CHANGEFILTER_H
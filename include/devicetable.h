@@ -0,0 +1,164 @@
+#ifndef DEVICETABLE_H
+#define DEVICETABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Small integer handle of an interned device path
+typedef uint32_t DeviceId;
+//! Handle of a string in the DeviceTable string pool, 0 is the empty string
+typedef uint32_t StringId;
+
+//! Handle that refers to no device or string
+#define INVALID_DEVICE_ID 0xffffffffu
+//! Records per chunk are 1 << DEVICE_TABLE_CHUNK_BITS
+#define DEVICE_TABLE_CHUNK_BITS 8
+//! Chunks per array, bounds the number of devices and metadata records to one million
+#define DEVICE_TABLE_CHUNKS 4096
+
+//! Static metadata of a device
+/*!
+ * Everything a device reports about itself when it is opened, packed into
+ * 32 bytes. Strings are handles into the DeviceTable string pool, so devices
+ * of the same model share a single copy of their manufacturer and product.
+ */
+struct DeviceInfo
+{
+    unsigned short vid = 0;
+    unsigned short pid = 0;
+    unsigned short version = 0;
+    //! Top-level collection's usage page
+    unsigned short usagePage = 0;
+    //! Top-level collection's usage ID
+    unsigned short usage = 0;
+    //! Maximum input report length, including the report ID
+    unsigned short inputReportLength = 0;
+    //! Maximum output report length, including the report ID
+    unsigned short outputReportLength = 0;
+    StringId manufacturer = 0;
+    StringId product = 0;
+    StringId serialNumber = 0;
+    //! Physical device the collection belongs to, shared by its other collections
+    StringId container = 0;
+
+    bool operator==(const DeviceInfo &o) const;
+    bool operator!=(const DeviceInfo &o) const {return !(*this == o);}
+};
+
+//! StringPool class
+/*!
+ * Interns wide strings into a single character arena. Lookups hash and
+ * compare the characters in place through an open-addressing table, so
+ * finding a string that is already interned allocates nothing. With folding
+ * enabled ASCII letters compare case-insensitively and are stored in lower
+ * case. Not thread-safe.
+ */
+
+class StringPool
+{
+    public:
+        //! \param fold     Compare and store ASCII letters case-insensitively
+        StringPool(bool fold);
+
+        //! Returns the handle of a string, adding it if it is new
+        uint32_t intern(const wchar_t *s, size_t length);
+        //! Returns the handle of a string, INVALID_DEVICE_ID if it was never interned
+        uint32_t find(const wchar_t *s, size_t length) const;
+        //! Copy of an interned string, empty for an unknown handle
+        std::wstring get(uint32_t id) const;
+
+        //! Number of interned strings
+        size_t size() const {return m_entries.size();}
+        //! Bytes allocated for characters, entries and the hash table
+        size_t bytes() const;
+
+    private:
+        struct Entry
+        {
+            uint32_t offset;
+            uint32_t length;
+            uint32_t hash;
+        };
+
+        uint32_t hash(const wchar_t *s, size_t length) const;
+        //! Slot holding the string or the empty slot where it belongs
+        size_t slot(const wchar_t *s, size_t length, uint32_t h) const;
+        //! Double the hash table and reinsert all entries
+        void grow();
+
+        bool m_fold;
+        std::vector<wchar_t> m_chars;
+        std::vector<Entry> m_entries;
+        //! Entry index per slot, INVALID_DEVICE_ID if empty
+        std::vector<uint32_t> m_slots;
+};
+
+//! DeviceTable class
+/*!
+ * Process-wide registry of device identities. A device path is interned once
+ * into a DeviceId, after which registries, the hotplug pipeline and callers
+ * compare and hash the integer instead of a wide string. Paths compare
+ * case-insensitively, as notifications and enumeration disagree on case.
+ *
+ * The static metadata of each device lives here rather than in its HidDevice:
+ * records are immutable and appended to chunked arrays that never move, and
+ * a device switches to a new record only if its metadata changes. Reading
+ * metadata is therefore lock-free, interning and updates take a mutex.
+ */
+
+class DeviceTable
+{
+    public:
+        //! The table shared by all devices
+        static DeviceTable &instance();
+        ~DeviceTable();
+
+        //! Returns the handle of a device path, adding it if it is new
+        DeviceId intern(const std::wstring &path) {return intern(path.c_str(), path.size());}
+        DeviceId intern(const wchar_t *path, size_t length);
+        //! Returns the handle of a device path, INVALID_DEVICE_ID if it was never interned
+        DeviceId find(const std::wstring &path) const;
+        //! Device path in lower case, empty for an unknown handle
+        std::wstring path(DeviceId id) const;
+
+        //! Metadata of a device, all zero until set
+        const DeviceInfo &info(DeviceId id) const;
+        //! Replace the metadata of a device
+        void setInfo(DeviceId id, const DeviceInfo &info);
+
+        //! Returns the handle of a metadata string, adding it if it is new
+        StringId internString(const std::wstring &s);
+        //! Copy of a metadata string
+        std::wstring string(StringId id) const;
+
+        //! Number of interned device paths
+        size_t size() const;
+        //! Bytes allocated for paths, strings and metadata records
+        size_t bytes() const;
+
+    private:
+        DeviceTable();
+        DeviceTable(const DeviceTable&) = delete;
+        DeviceTable &operator=(const DeviceTable&) = delete;
+
+        //! Allocate the chunk holding a metadata record, false if the table is full
+        bool reserveRecord(uint32_t index);
+        //! Allocate the chunk holding a device's current record, false if the table is full
+        bool reserveDevice(DeviceId id);
+
+        mutable std::mutex m_mutex;
+        StringPool m_paths;
+        StringPool m_strings;
+        //! Number of metadata records, record 0 is all zero
+        uint32_t m_records = 0;
+        //! Metadata records, never modified once published
+        std::atomic<DeviceInfo*> m_infos[DEVICE_TABLE_CHUNKS];
+        //! Current metadata record per device
+        std::atomic<std::atomic<uint32_t>*> m_current[DEVICE_TABLE_CHUNKS];
+};
+
+#endif // DEVICETABLE_H
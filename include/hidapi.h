@@ -2,7 +2,6 @@
 #define HIDAPI_H
 
 #include <windows.h>
-#include <dbt.h>
 extern "C"
 {
 #include <hidsdi.h>
@@ -11,9 +10,24 @@ extern "C"
 #include <algorithm>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "devicetable.h"
 #include "hiddevice.h"
+#include "hiddevicegroup.h"
+#include "hotplugpipeline.h"
+#include "hotplugsource.h"
+
+//! Number of threads probing arriving devices
+#define HOTPLUG_WORKERS 4
+
+//! Maps interned device paths to device objects
+typedef std::map<DeviceId, std::shared_ptr<HidDevice>> HidDeviceMap;
+//! Maps containers to the collections of one physical device
+typedef std::map<StringId, std::shared_ptr<HidDeviceGroup>> HidDeviceGroupMap;
 
 //! HidApi class
 /*!
@@ -39,6 +53,11 @@ class HidApi
 		 * \param path	Device path
 		 */
 		HidDevice *getHidDevice(std::wstring path);
+		//! Returns pointer to the device with specified path handle
+		/*!
+		 * \param id	Device path interned in the DeviceTable
+		 */
+		HidDevice *getHidDevice(DeviceId id);
 
 		//! Enumerates all HID devices present in the system
 		bool enumerate();
@@ -52,62 +71,112 @@ class HidApi
 		 * \param cb	The function to call when a device is removed
 		 */
         void setCallbackRemoval(std::function<void(HidDevice*)> cb) {m_callbackRemoval = cb;};
-
-        //! Container for maping device paths to device objects
-        std::map<std::wstring, HidDevice*> m_devices;
-
-	protected:
-		//! Window handle
-		HWND m_hwnd;
-		//! Device notification handle
-		HDEVNOTIFY m_hDeviceNotify;
-
-	private:
+		//! Sets the function to be called with all devices that arrived together
+		/*!
+		 * Called after the per-device arrival callbacks of each hotplug batch.
+		 * \param cb	The function to call with the arrived devices
+		 */
+        void setCallbackArrivalBatch(std::function<void(const std::vector<HidDevice*>&)> cb) {m_callbackArrivalBatch = cb;};
+		//! Sets how long notifications for a device are held to coalesce remove/add flaps
 		/*!
-		 * Creates a window which can receive device notifications.
-		 * Use GetLastError() to obtain more specific error information.
-		 * \return		Return value of CreateWindow
+		 * \param ms	Debounce interval in milliseconds, 100 by default
 		 */
-		bool createWindow();
+        void setHotplugDebounce(unsigned int ms) {m_hotplug->setDebounce(ms);};
+		//! Replaces the source of arrival and removal notifications
 		/*!
-		 * Registers a window class for subsequent use in call to the CreateWindow.
-		 * Use GetLastError() to obtain more specific error information.
-		 * \return		Return value of RegisterClass
+		 * By default notifications come from the configuration manager
+		 * (DeviceInterfaceSource). A SyntheticHotplugSource lets tests inject them.
+		 * \param source	The new source, started immediately
+		 * \return		False if the source could not be started
 		 */
-		bool registerWindow();
+		bool setHotplugSource(std::unique_ptr<HotplugSource> source);
 
+		//! Plugs in a simulated device
+		/*!
+		 * The device goes through the same hotplug handling as a real one,
+		 * including the arrival callbacks. Plugging in a path again after
+		 * removal reconnects the existing HidDevice.
+		 * \param sim	Simulated device
+		 */
+		void addSimulatedDevice(std::shared_ptr<SimulatedDevice> sim);
+		//! Unplugs a simulated device
 		/*!
-		 * Receives notification and passes it to the class member.
-		 * \param hwnd	Window handle
-		 * \param uMsg	The message
-		 * \param wParam	Additional message information
-		 * \param lParam	Additional message information
+		 * \param path	Path of the simulated device
 		 */
-		static LRESULT CALLBACK s_wndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+		void removeSimulatedDevice(const std::wstring &path);
+        //! Returns the current device registry
+        /*!
+         * The registry is published as immutable snapshots: hotplug never
+         * modifies a map that has been handed out but publishes a new one.
+         * Any thread may iterate a snapshot without locking, and the devices
+         * in it stay alive as long as the snapshot is held. Keep the returned
+         * pointer in a variable while iterating.
+         */
+        std::shared_ptr<const HidDeviceMap> devices() const {return std::atomic_load(&m_devices);}
+        //! Returns the current physical devices, each grouping its top-level collections
+        /*!
+         * Published like devices(). Groups are never removed, a group gains
+         * collections as they are found.
+         */
+        std::shared_ptr<const HidDeviceGroupMap> groups() const {return std::atomic_load(&m_groups);}
+        //! Returns the group a device belongs to, null if it is not in the registry
+        HidDeviceGroup *getHidDeviceGroup(HidDevice *device);
+
+	private:
 		/*!
-		 * Passes device notification to devAdded or devRemoved.
-		 * \param hwnd	Window handle
-		 * \param uMsg	The message
-		 * \param wParam	Additional message information
-		 * \param lParam	Additional message information
+		 * Publishes a new registry snapshot with the given devices added,
+		 * and adds them to the group of their container.
+		 * Paths already in the registry keep their existing device object,
+		 * which replaces the one passed in added.
+		 * \param added	Devices to add, by interned path, receives the registered devices
 		 */
-		LRESULT wndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+		void publish(HidDeviceMap &added);
 
 		/*!
-		 * Inserts the added device into m_devices and calls user-defined callback.
-		 * \param d		Identifies the device which generated the notification
+		 * Passes a notification from the hotplug source to the hotplug pipeline.
+		 * \param path	Path of the device which generated the notification
+		 * \param present	True on arrival, false on removal
 		 */
-		void devAdded(DEV_BROADCAST_DEVICEINTERFACE &d);
+		void devChanged(const std::wstring &path, bool present);
 		/*!
-		 * Closes the device and calls user-defined callback.
-		 * \param d		Identifies the device which generated the notification
+		 * Runs on a hotplug worker. Probes and publishes an arrived device or
+		 * closes a removed one, and records it for the batch callbacks.
+		 * \param id	Interned device path
+		 * \param present	True if the device is present after the coalesced events
+		 * \param flapped	True if the device was removed in between
 		 */
-		void devRemoved(DEV_BROADCAST_DEVICEINTERFACE &d);
+		void hotplugEvent(DeviceId id, bool present, bool flapped);
+		/*!
+		 * Calls user-defined callbacks for the devices of a finished hotplug batch.
+		 */
+		void hotplugBatchComplete();
+
+		//! Simulated devices plugged in so far, by interned path
+		std::map<DeviceId, std::shared_ptr<SimulatedDevice>> m_simulated;
+		//! Protects m_simulated
+		std::mutex m_simulatedMutex;
+		//! Current registry snapshot, only replaced through std::atomic_store
+		std::shared_ptr<const HidDeviceMap> m_devices = std::make_shared<HidDeviceMap>();
+		//! Current group snapshot, only replaced through std::atomic_store
+		std::shared_ptr<const HidDeviceGroupMap> m_groups = std::make_shared<HidDeviceGroupMap>();
+		//! Serializes registry and group updates
+		std::mutex m_devicesMutex;
+
+		//! Moves hotplug handling off the notification thread
+		std::unique_ptr<HotplugPipeline> m_hotplug;
+		//! Delivers arrival and removal notifications
+		std::unique_ptr<HotplugSource> m_hotplugSource;
+		//! Devices handled in the current hotplug batch
+		std::vector<HidDevice*> m_arrivals, m_removals;
+		//! Protects m_arrivals and m_removals
+		std::mutex m_batchMutex;
 
 		//! User-defined callback for device arrivals
 		std::function<void(HidDevice*)> m_callbackArrival = nullptr;
 		//! User-defined callback for device removals
 		std::function<void(HidDevice*)> m_callbackRemoval = nullptr;
+		//! User-defined callback for batches of arrived devices
+		std::function<void(const std::vector<HidDevice*>&)> m_callbackArrivalBatch = nullptr;
 
 };
 
@@ -0,0 +1,155 @@
+#ifndef HIDCLIENT_H
+#define HIDCLIENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hidprotocol.h"
+
+//! Number of input reports a RemoteDevice buffers for blocking read()
+#define REMOTE_READ_QUEUE 64
+
+class HidClient;
+
+//! RemoteDevice class
+/*!
+ * A device served by HidServer in another process. Offers the same calls
+ * as HidDevice for opening, reading and writing. Once opened the server
+ * streams input reports continuously: they are passed to the read complete
+ * callback if one is set, otherwise buffered for read().
+ */
+
+class RemoteDevice
+{
+    public:
+        //! Open the device on the server
+        /*!
+         * \return      True if the server opened the device
+         */
+        bool open();
+        //! Close the device on the server
+        bool close();
+        bool isOpen() {return m_open;}
+        bool isConnected() {return m_info.connected;}
+
+        unsigned short getPid() {return m_info.pid;}
+        unsigned short getVid() {return m_info.vid;}
+        unsigned short getVersionNumber() {return m_info.versionNumber;}
+        unsigned short getUsagePage() {return m_info.usagePage;}
+        unsigned short getUsage() {return m_info.usage;}
+        size_t getInputReportLength() {return m_info.inputReportLength;}
+        size_t getOutputReportLength() {return m_info.outputReportLength;}
+        std::wstring getPath() {return m_info.path;}
+        std::wstring getManufacturer() {return m_info.manufacturer;}
+        std::wstring getProduct() {return m_info.product;}
+        std::wstring getSerialNumber() {return m_info.serialNumber;}
+
+        //! Set the function to be called for every input report, from the client's receive thread
+        void setCallbackReadComplete(std::function<void(RemoteDevice*)> cb);
+        //! Set the function to be called when the device is removed
+        void setCallbackRemoval(std::function<void(RemoteDevice*)> cb) {m_callbackRemoval = cb;}
+        //! Wait for the next input report and copy it to m_readBuf
+        /*!
+         * \return      False if the device was closed, removed or the client disconnected
+         */
+        bool read();
+        //! Write one output report of m_outputReportLength bytes
+        bool write(const void *b);
+        //! Write count consecutive output reports in a single message
+        bool writeBatch(const void *reports, size_t count);
+
+        //! Read buffer
+        unsigned char *m_readBuf = nullptr;
+
+    private:
+        friend class HidClient;
+
+        explicit RemoteDevice(HidClient *client) : m_client(client) {}
+        //! Deliver a report from the receive thread
+        void received(const unsigned char *report, size_t length);
+        //! Mark as removed or disconnected and wake up readers
+        void lost();
+
+        HidClient *m_client;
+        HidDeviceInfo m_info;
+        bool m_open = false;
+        //! Answer to a pending open(), -1 while waiting
+        int m_openResult = -1;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        //! Reports waiting for read()
+        std::deque<std::vector<unsigned char>> m_pending;
+        std::vector<unsigned char> m_buf;
+
+        std::function<void(RemoteDevice*)> m_callbackReadComplete = nullptr;
+        std::function<void(RemoteDevice*)> m_callbackRemoval = nullptr;
+};
+
+//! HidClient class
+/*!
+ * Connects to a HidServer and mirrors its device list as RemoteDevice
+ * objects, which stay valid until the client is destroyed.
+ */
+
+class HidClient
+{
+    public:
+        HidClient();
+        //! Disconnects
+        ~HidClient();
+
+        //! Connect to the server socket and fetch the device list
+        bool connect(const std::string &socketPath);
+        //! Disconnect from the server, open devices are closed by the server
+        void disconnect();
+        //! Fetch the device list again
+        bool enumerate();
+
+        //! All devices known to the client
+        std::vector<RemoteDevice*> devices();
+        //! Returns pointer to the device with specified vendor and product id
+        RemoteDevice *getDevice(unsigned short vid, unsigned short pid);
+
+        //! Sets the function to be called when a device arrives at the server
+        void setCallbackArrival(std::function<void(RemoteDevice*)> cb) {m_callbackArrival = cb;}
+        //! Sets the function to be called when a device is removed from the server
+        void setCallbackRemoval(std::function<void(RemoteDevice*)> cb) {m_callbackRemoval = cb;}
+
+    private:
+        friend class RemoteDevice;
+
+        //! Parse frames from the server until it disconnects
+        void receiverThread();
+        //! Send a complete frame
+        bool send(const std::vector<unsigned char> &frame);
+        //! Create or update a device from its description, caller holds m_mutex
+        RemoteDevice *update(const HidDeviceInfo &info);
+
+        uintptr_t m_socket;
+        std::thread m_receiver;
+        std::atomic<bool> m_connected {false};
+
+        std::mutex m_mutex;
+        //! Wakes callers waiting for enumerate() and open() answers
+        std::condition_variable m_cv;
+        std::map<uint32_t, std::unique_ptr<RemoteDevice>> m_devices;
+        //! Incremented on every device list received
+        unsigned long m_enumerations = 0;
+        //! Serializes socket writes
+        std::mutex m_sendMutex;
+
+        std::function<void(RemoteDevice*)> m_callbackArrival = nullptr;
+        std::function<void(RemoteDevice*)> m_callbackRemoval = nullptr;
+};
+
+#endif // HIDCLIENT_H
@@ -0,0 +1,123 @@
+#ifndef HIDCLOCK_H
+#define HIDCLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+class VirtualClock;
+
+//! HidClock class
+/*!
+ * Monotonic time source used for deadlines and measurements. It follows the
+ * steady clock unless a VirtualClock is installed, in which case all time
+ * stamps, deadlines and windows of the library run on virtual time.
+ */
+
+class HidClock
+{
+    public:
+        //! Current time in nanoseconds since an unspecified epoch
+        static uint64_t now();
+        //! Current steady clock time, ignoring any virtual clock
+        /*!
+         * For measuring the cost of work on this machine, e.g. spin budgets.
+         */
+        static uint64_t steady()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        //! Make now() follow a virtual clock, null to return to the steady clock
+        /*!
+         * Install the clock before creating HidApi, devices and schedulers and
+         * remove it once they are gone, so no deadline mixes both time bases.
+         */
+        static void setVirtual(VirtualClock *clock) {s_virtual.store(clock, std::memory_order_release);}
+        //! The installed virtual clock, null if none
+        static VirtualClock *getVirtual() {return s_virtual.load(std::memory_order_acquire);}
+
+        //! Wakes a waiting thread whenever the virtual clock advances
+        /*!
+         * Timed waits keep their real-time bound, so threads still notice
+         * closing while virtual time stands still; a listener cuts them short
+         * when it moves. Does nothing under the steady clock.
+         *
+         * Listeners run with the clock's lock held. To notify a condition
+         * variable without losing a wake-up they may take the waiter's mutex,
+         * which orders the clock's lock before it: a listener is created and
+         * destroyed without that mutex held, and no code holding it may call
+         * VirtualClock::advance() or advanceTo(). HidClock::now() takes no lock.
+         */
+        class Listener
+        {
+            public:
+                //! \param cb   Called with the clock locked, it may lock the waiter's mutex, see above
+                Listener(std::function<void()> cb);
+                ~Listener();
+
+            private:
+                Listener(const Listener&) = delete;
+                Listener &operator=(const Listener&) = delete;
+
+                VirtualClock *m_clock;
+                int m_id = -1;
+        };
+
+    private:
+        static std::atomic<VirtualClock*> s_virtual;
+};
+
+//! VirtualClock class
+/*!
+ * Time source that only moves when told to. With it installed in HidClock,
+ * simulated devices release their reports at virtual due times and stamp
+ * them with those times, and timeouts, debouncing, periodic writes and
+ * aggregation windows follow the same timeline. A test can replay hours of
+ * traffic in seconds, and the time stamps and windows it sees do not depend
+ * on the speed or load of the machine, provided it lets the pipeline drain
+ * before advancing again, e.g. by waiting for the expected report count.
+ */
+
+class VirtualClock
+{
+    public:
+        //! \param start    Initial time in nanoseconds, zero is avoided as it marks unset time stamps
+        VirtualClock(uint64_t start = 1000000000);
+
+        //! Current virtual time in nanoseconds
+        uint64_t now() const {return m_now.load(std::memory_order_acquire);}
+        //! Move the time forward and wake all waiting threads
+        /*!
+         * Listeners take the mutexes of the waiting components, so this must
+         * not be called with a device, queue or pipeline lock held, e.g. only
+         * from the test thread or from callbacks the library runs unlocked.
+         */
+        void advance(uint64_t ns);
+        //! Move the time forward to the given time, never back
+        void advanceTo(uint64_t time);
+
+    private:
+        friend class HidClock::Listener;
+
+        int subscribe(std::function<void()> cb);
+        void unsubscribe(int id);
+
+        std::atomic<uint64_t> m_now;
+        //! Protects m_listeners, held while they are called
+        std::mutex m_mutex;
+        std::map<int, std::function<void()>> m_listeners;
+        int m_nextId = 0;
+};
+
+inline uint64_t HidClock::now()
+{
+    VirtualClock *clock = s_virtual.load(std::memory_order_acquire);
+    return clock ? clock->now() : steady();
+}
+
+#endif // HIDCLOCK_H
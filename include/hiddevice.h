@@ -6,6 +6,7 @@
 #endif
 
 #define TIMEOUT 50
+#define SPIN_BUDGET_MIN_DIV 16
 
 #include <windows.h>
 #include <winioctl.h>
@@ -16,9 +17,31 @@ extern "C"
 #include <hidsdi.h>
 }
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include "callbackexecutor.h"
+#include "changefilter.h"
+#include "devicetable.h"
+#include "reportaggregator.h"
+#include "reportarchive.h"
+#include "reportlogger.h"
+#include "reportpredicate.h"
+#include "reportpublisher.h"
+#include "reportqueue.h"
+#include "reportsnapshot.h"
+#include "roundtripprobe.h"
+#include "simulateddevice.h"
+#include "writecoalescer.h"
+
+class HidDeviceGroup;
 
 //! HidDevice class
 /*!
@@ -27,11 +50,59 @@ extern "C"
 
 class HidDevice
 {
+    friend class HidDeviceGroup;
+
 	public:
+        //! Read loop wait statistics
+        struct WaitStats
+        {
+            //! Reads that completed while spinning
+            unsigned long long spinHits = 0;
+            //! Reads that outlasted the spin budget and blocked
+            unsigned long long blocks = 0;
+            //! Total time spent spinning, in nanoseconds
+            uint64_t spinNs = 0;
+            //! Total time from issuing a read to its completion, in nanoseconds
+            uint64_t waitNs = 0;
+            //! Current adaptive spin budget, in nanoseconds
+            uint64_t budgetNs = 0;
+        };
+
+        //! User-defined callbacks of the device
+        /*!
+         * Published as an immutable set: setters copy the current set, change
+         * one callback and publish the copy. The read loop, dispatch thread and
+         * executor take the current set once per report and keep it alive while
+         * calling, so callbacks can be replaced while streaming without losing
+         * reports or tearing a callback being invoked.
+         */
+        struct Handlers
+        {
+            //! Called when the device is removed
+            std::function<void(HidDevice*)> removal = nullptr;
+            //! Called when a non-blocking read completed, the report is in m_readBuf
+            std::function<void(HidDevice*)> readComplete = nullptr;
+            //! Called with every received report, instead of readComplete when set
+            std::function<void(HidDevice*, const unsigned char*, size_t)> report = nullptr;
+            //! Called with every finished aggregation window
+            std::function<void(HidDevice*, const ReportAggregate&)> aggregate = nullptr;
+            //! Called with the changed bits of every changed report
+            std::function<void(HidDevice*, const unsigned char*, const unsigned char*, size_t)> reportChanged = nullptr;
+            //! Called when a non-blocking write completed
+            std::function<void(HidDevice*)> writeComplete = nullptr;
+        };
+
 		//! Initializes the OVERLAPPED structure
 		HidDevice();
 		//! Initializes the OVERLAPPED structure and sets device path
 		HidDevice(std::wstring path);
+        //! Creates a device for a path interned in the DeviceTable
+        HidDevice(DeviceId id);
+        //! Creates a device backed by a simulated device instead of the driver
+        /*!
+         * \param sim   Simulated device, its path becomes the device path
+         */
+        HidDevice(std::shared_ptr<SimulatedDevice> sim);
 		//! Closes device handle, deletes buffer and joins separate threads
 		~HidDevice();
 
@@ -49,7 +120,12 @@ class HidDevice
 		/*!
          * \return		False if device not ready for I/O
 		 */
-        bool isOpen() {return INVALID_HANDLE_VALUE != m_handle;}
+        bool isOpen() {return m_sim ? m_simOpen : INVALID_HANDLE_VALUE != m_handle;}
+        //! Get the simulated device backing this device
+        /*!
+         * \return  Simulated device or nullptr for real devices
+         */
+        SimulatedDevice *getSimulated() {return m_sim.get();}
         //! Signal the device object that the device has been removed
         /*!
          * Closes the device and marks as removed.
@@ -57,9 +133,25 @@ class HidDevice
         void removed();
         //! Signal the device object that the device has been reconnected
         /*!
-         * Simply marks the device as connected.
+         * Marks the device as connected. With automatic reconnect enabled a
+         * device that was open when removed is reopened, and continuous
+         * reading is restarted if it was running.
+         */
+        void connected();
+        //! Reopen the device and resume reading automatically after it has been reconnected
+        /*!
+         * Blocking modes, callbacks and queue settings are kept across the
+         * reconnect, and the descriptor data read by the first open() is reused.
+         * \param a     true - reconnect automatically, false - leave it to the application (default)
+         */
+        void setAutoReconnect(bool a) {m_autoReconnect = a;}
+        //! Number of automatic reconnects so far
+        unsigned long getReconnects() {return m_reconnects;}
+        //! Time from the last automatic reconnect to the first report received after it
+        /*!
+         * \return  Latency in nanoseconds, 0 if no report was received after a reconnect yet
          */
-        void connected() {m_connected = true;}
+        uint64_t getReconnectLatencyNs() {return m_reconnectLatency;}
         //! Check if the device is connected
         /*!
          * \return  true if connected, false otherwise
@@ -70,46 +162,79 @@ class HidDevice
 		/*!
          * \return Product ID
 		 */
-        unsigned short getPid() {return m_attributes.ProductID;}
+        unsigned short getPid() {return getInfo().pid;}
 		//! Function
 		/*!
          * \return Vendor ID
 		 */
-        unsigned short getVid() {return m_attributes.VendorID;}
+        unsigned short getVid() {return getInfo().vid;}
 		//! Function
 		/*!
          * \return Version number
 		 */
-        unsigned short getVersionNumber() {return m_attributes.VersionNumber;}
-        //! Get the device path
-        std::wstring getPath() {return m_path;}
+        unsigned short getVersionNumber() {return getInfo().version;}
+        //! Get the handle of the device path in the DeviceTable
+        DeviceId getId() const {return m_id;}
+        //! Get the device path, in lower case
+        std::wstring getPath() {return DeviceTable::instance().path(m_id);}
+        //! Get the static metadata read when the device was opened
+        /*!
+         * Lock-free, the reference stays valid for the lifetime of the
+         * process but is not updated if the device reports new metadata.
+         */
+        const DeviceInfo &getInfo() const {return DeviceTable::instance().info(m_id);}
+        //! Get the top-level collection's usage page
+        unsigned short getUsagePage() {return getInfo().usagePage;}
+        //! Get the top-level collection's usage ID
+        unsigned short getUsage() {return getInfo().usage;}
+        //! Get the maximum input report length, including the report ID
+        size_t getInputReportLength() {return m_inputReportLength;}
+        //! Get the maximum output report length, including the report ID
+        size_t getOutputReportLength() {return m_outputReportLength;}
         //! Get the device manufacturer string
-        std::wstring getManufacturer() {return m_manufacturer;}
+        std::wstring getManufacturer() {return DeviceTable::instance().string(getInfo().manufacturer);}
         //! Get the device product string
-        std::wstring getProduct() {return m_product;}
+        std::wstring getProduct() {return DeviceTable::instance().string(getInfo().product);}
         //! Get the device serial number string
-        std::wstring getSerialNumber() {return m_serialNumber;}
+        std::wstring getSerialNumber() {return DeviceTable::instance().string(getInfo().serialNumber);}
 
 		//! Set the function to be called when device is removed
 		/*!
 		 * \param cb	Callback
 		 */
-        void setCallbackRemoval(std::function<void(HidDevice*)> cb) {m_callbackRemoval = cb;}
+        void setCallbackRemoval(std::function<void(HidDevice*)> cb) {setHandler(&Handlers::removal, cb);}
 		//! Get the function to be called when device is removed
 		/*!
 		 * \return		Callback or nullptr
 		 */
-        std::function<void(HidDevice*)> getCallbackRemoval() {return m_callbackRemoval;}
+        std::function<void(HidDevice*)> getCallbackRemoval() {return getHandlers()->removal;}
         //! Set the function to be called when non-blocking read is completed
         /*!
          * \param cb	Callback
          */
-        void setCallbackReadComplete(std::function<void(HidDevice*)> cb) {m_callbackReadComplete = cb;}
+        void setCallbackReadComplete(std::function<void(HidDevice*)> cb) {setHandler(&Handlers::readComplete, cb);}
+        //! Set the function to be called with every received report
+        /*!
+         * Called instead of the read complete callback when set. The report is
+         * passed in, so the callback does not depend on m_readBuf and may run
+         * concurrently with itself on an order-insensitive executor.
+         * \param cb    Callback taking the device, report and its length
+         */
+        void setCallbackReport(std::function<void(HidDevice*, const unsigned char*, size_t)> cb) {setHandler(&Handlers::report, cb);}
 		//! Set the function to be called when non-blocking write is completed
 		/*!
 		 * \param cb	Callback
 		 */
-        void setCallbackWriteComplete(std::function<void(HidDevice*)> cb) {m_callbackWriteComplete = cb;}
+        void setCallbackWriteComplete(std::function<void(HidDevice*)> cb) {setHandler(&Handlers::writeComplete, cb);}
+        //! Replace all callbacks at once
+        /*!
+         * Takes effect with the next report, also while reading. No report
+         * sees a mix of the old and new callbacks.
+         * \param handlers  New callbacks, unset ones are not called
+         */
+        void setHandlers(const Handlers &handlers);
+        //! Get the current callbacks
+        std::shared_ptr<const Handlers> getHandlers() const {return std::atomic_load(&m_handlers);}
 
 		//! Set read to be blocking or non-blocking
 		/*!
@@ -121,6 +246,171 @@ class HidDevice
          * \param a     true - continuous read, false - single read
          */
         void setReadContinuous(bool a) {m_readContinuous = a;}
+        //! Set the number of input reports the HID class driver buffers for the device
+        /*!
+         * Takes effect on the next open(). The driver accepts values from 2 to 512.
+         * \param n     Number of kernel input buffers (64 by default)
+         */
+        void setNumInputBuffers(unsigned long n) {m_numInputBuffers = n;}
+        //! Set the depth of the user-space queue between the read loop and the read callback
+        /*!
+         * With a non-zero depth the continuous read loop only queues reports and
+         * a separate thread invokes the read complete callback, so a slow callback
+         * no longer holds up reading. While reading with a queue a new non-zero
+         * depth resizes it in place, keeping queued reports; switching between
+         * zero and non-zero takes effect on the next non-blocking read().
+         * \param depth Number of queued reports, 0 (default) calls back from the read loop
+         */
+        void setQueueDepth(size_t depth);
+        //! Set what happens to reports arriving while the queue is full
+        /*!
+         * Takes effect at once, also on a queue in use.
+         * \param policy    Overflow policy (OverflowPolicy::Block by default)
+         */
+        void setOverflowPolicy(OverflowPolicy policy);
+        //! Number of reports discarded or overwritten because the queue was full
+        /*!
+         * Counts since the device was created, across reads. Safe to call while reading.
+         */
+        unsigned long long getDroppedReports();
+        //! Keep the latest report of every report ID for polling with snapshot()
+        /*!
+         * Enabling takes effect on the next non-blocking read(), which allocates
+         * the snapshots; disabling takes effect at once, also while reading.
+         * Callbacks are still invoked if set, polling consumers can simply
+         * leave them unset.
+         * \param a     true - keep snapshots, false - do not (default)
+         */
+        void setSnapshotMode(bool a) {m_snapshotMode = a;}
+        //! Copy the most recent report with the given report ID
+        /*!
+         * Never blocks the read loop and may be called from any number of threads.
+         * \param id        Report ID, 0 for devices not using report IDs
+         * \param buf       Buffer of at least getInputReportLength() bytes
+         * \param length    Receives the report length
+         * \param sequence  Optionally receives the number of reports seen with this ID
+         * \return          False if snapshot mode is off or no such report was received yet
+         */
+        bool snapshot(unsigned char id, unsigned char *buf, size_t &length,
+                      unsigned long long *sequence = nullptr);
+        //! Publish every received report in a shared memory ring for other processes
+        /*!
+         * Any number of local processes can read the ring with ReportSubscriber.
+         * Takes effect on the next non-blocking read(), which replaces the ring
+         * if the name or size changed.
+         * \param name      Mapping name, e.g. L"Local\\yaha-joystick", empty (default) disables publishing
+         * \param slots     Number of reports the ring holds
+         */
+        void setPublisher(const std::wstring &name, size_t slots = 1024) {m_publisherName = name; m_publisherSlots = slots;}
+        //! Summarize report fields over time windows
+        /*!
+         * The read loop folds every report into per-field min/max/mean/last
+         * statistics and passes one aggregate per window to the aggregate
+         * callback, so low-rate consumers do not need the per-report callbacks.
+         * Takes effect on the next non-blocking read().
+         * \param fields    Fields to summarize
+         * \param windowUs  Window length in microseconds, 0 (default) disables aggregation
+         * \param hopUs     Time between sliding windows, 0 for tumbling windows
+         */
+        void setAggregation(const ReportFieldTable &fields, unsigned long windowUs, unsigned long hopUs = 0)
+            {m_aggregateFields = fields; m_aggregateWindowUs = windowUs; m_aggregateHopUs = hopUs;}
+        //! Set the function to be called with every finished window
+        /*!
+         * Called from the read loop when the first report after the window arrives.
+         * \param cb    Callback taking the device and the window summary
+         */
+        void setCallbackAggregate(std::function<void(HidDevice*, const ReportAggregate&)> cb) {setHandler(&Handlers::aggregate, cb);}
+        //! Get the ring reports are published to, for subscriber lag statistics
+        /*!
+         * \return          Publisher or nullptr if not publishing
+         */
+        ReportPublisher *getPublisher() {return m_publisher.get();}
+        //! Only dispatch reports matching a predicate
+        /*!
+         * The predicate runs in the read loop before the change filter.
+         * Rejected reports still reach loggers, archives, snapshots, publishers
+         * and aggregation, but are neither queued nor passed to callbacks.
+         * Takes effect with the next report, also while reading.
+         * \param predicate     Filter, an empty predicate dispatches all reports (default)
+         */
+        void setReportFilter(const ReportPredicate &predicate);
+        //! Number of reports rejected by the report filter
+        unsigned long long getFilteredReports() {return m_filteredReports;}
+        //! Suppress reports identical to the previous report of the same report ID
+        /*!
+         * Unchanged reports still update snapshots but are neither queued nor
+         * passed to callbacks. Takes effect at once, also while reading; after
+         * enabling, the first report of every report ID counts as changed.
+         * \param a     true - only dispatch changed reports, false - dispatch all (default)
+         */
+        void setChangeFilter(bool a);
+        //! Set bits to leave out when looking for changes, e.g. counters or timestamps
+        /*!
+         * Takes effect with the next report, also while reading.
+         * \param mask      Byte i masks report byte i (report ID included), set bits are ignored
+         * \param length    Number of bytes in mask, the rest of the report is compared in full
+         */
+        void setChangeIgnoreMask(const unsigned char *mask, size_t length);
+        //! Set the function to be called with the bits that changed in a report
+        /*!
+         * Called from the read loop for every changed report while the change
+         * filter is enabled. changed holds the XOR of the report with the previous
+         * one of its report ID, with ignored bits cleared.
+         * \param cb    Callback taking the device, report, changed bits and length
+         */
+        void setCallbackReportChanged(std::function<void(HidDevice*, const unsigned char*, const unsigned char*, size_t)> cb) {setHandler(&Handlers::reportChanged, cb);}
+        //! Run the report callbacks on a shared executor instead of the read thread
+        /*!
+         * The device is bound to one shard of the executor, which keeps its reports
+         * in order. With orderInsensitive set and a report callback (see
+         * setCallbackReport()) idle shards may also take its reports, so they can
+         * be handled out of order and in parallel. The executor must outlive the
+         * device or be removed first. Takes effect on the next non-blocking read().
+         * \param executor          Executor, nullptr (default) calls back from the read or dispatch thread
+         * \param orderInsensitive  true - reports may be stolen by other shards
+         * \param shard             Shard to bind to, -1 picks one round-robin
+         */
+        void setExecutor(CallbackExecutor *executor, bool orderInsensitive = false, int shard = -1);
+        //! Pass every received report to a round-trip probe
+        /*!
+         * Set by RoundTripProbe::run() for the duration of a run.
+         * \param probe     Probe, nullptr to stop
+         */
+        void setProbe(RoundTripProbe *probe) {m_probe = probe;}
+        //! Log every received report as text
+        /*!
+         * Reports are logged before the change filter, so the log holds
+         * everything the device sent. Takes effect immediately.
+         * \param logger    Open logger, may be shared by many devices, nullptr to stop
+         */
+        void setLogger(ReportLogger *logger) {m_logger = logger;}
+        //! Record every received report in an archive
+        /*!
+         * The device is registered in the archive under its path. Takes effect immediately.
+         * \param archive   Open archive, may be shared by many devices, nullptr to stop
+         */
+        void setArchive(ReportArchiveWriter *archive);
+        //! Number of reports suppressed by the change filter
+        unsigned long long getSuppressedReports() {return m_suppressedReports;}
+        //! Busy-poll for read completion before blocking
+        /*!
+         * The read loop spins on the pending read for up to the budget and only
+         * then waits on the event, which saves the wake-up latency of a blocked
+         * thread at the cost of CPU time. The budget adapts: it shrinks while reads
+         * keep outlasting it and grows back towards the maximum on spin hits.
+         * Takes effect on the next non-blocking read().
+         * \param us    Maximum spin time per read in microseconds, 0 (default) always blocks
+         */
+        void setSpinBudget(unsigned int us) {m_spinBudgetNs = uint64_t(us) * 1000;}
+        //! Pin the read thread to one CPU
+        /*!
+         * Mostly useful together with a spin budget, to keep the spinning thread
+         * off the cores doing other work. Takes effect on the next non-blocking read().
+         * \param cpu   Zero-based CPU index, -1 (default) leaves the thread unpinned
+         */
+        void setReadCpu(int cpu) {m_readCpu = cpu;}
+        //! Spin and block counts of the read loop, to weigh latency against CPU time
+        WaitStats getWaitStats();
 		//! Read from the device
 		/*!
          * Read from the device (blocking by default)
@@ -139,6 +429,54 @@ class HidDevice
          * (m_outputReportLength).
 		 */
         bool write(LPVOID b);
+        //! Start writing a report without waiting for it to complete
+        /*!
+         * The report is copied, so the buffer may be reused immediately. Only
+         * one submitted report is in flight at a time, the call fails instead
+         * of waiting if the previous one has not completed yet or writeBatch()
+         * is running.
+         * \param b         Pointer to the data to write
+         * \param length    Number of bytes in b, padded with zeros to m_outputReportLength
+         * \return          False if the device is busy, closed or the write failed to start
+         */
+        bool submitWrite(const void *b, size_t length);
+        //! Wait for the report started by submitWrite() to be written
+        /*!
+         * \param timeout   Time-out interval, in milliseconds
+         * \return          False if the write did not complete in time
+         */
+        bool waitSubmitted(DWORD timeout);
+        //! Write a report, replacing an older one with the same key not sent yet
+        /*!
+         * Latest-value-wins write: reports are sent in order by a separate thread,
+         * but if the application posts faster than the device accepts them only
+         * the newest report per key is sent. Output latency therefore stays
+         * within about one report time.
+         * \param b         Pointer to the data to write, copied
+         * \param length    Number of bytes in b
+         * \param key       Coalescing key, -1 (default) uses the report ID (first byte)
+         * \return          False if the device is not open
+         */
+        bool writeLatest(const void *b, size_t length, int key = -1);
+        //! Write many consecutive output reports with several in flight
+        /*!
+         * Blocks until the whole batch is written or a report fails; the
+         * remaining reports are then not sent. Each report must complete
+         * within TIMEOUT.
+         * \param reports   count reports of exactly m_outputReportLength bytes each, back to back
+         * \param count     Number of reports
+         * \param failed    Optionally receives the index of the failed report, count on success
+         * \param depth     Maximum number of reports in flight, 1 to MAXIMUM_WAIT_OBJECTS
+         * \return          True if all reports were written
+         */
+        bool writeBatch(const void *reports, size_t count, size_t *failed = nullptr, unsigned int depth = 8);
+        //! Number of reports replaced by newer ones before writeLatest() sent them
+        unsigned long long getCoalescedWrites();
+        //! Number of writeLatest() reports that failed or timed out, since the device was created
+        /*!
+         * A write not done within TIMEOUT is cancelled, so the next report is sent.
+         */
+        unsigned long long getFailedWrites() {return m_failedWrites;}
         //! Run in different thread to provide asynchronous reading
 		/*!
          * Waits in alertable state for asynchronous read to complete.
@@ -150,6 +488,18 @@ class HidDevice
          * \param b     Pointer to the data to write
          */
         void writeThread(LPVOID b);
+        //! Run in different thread to deliver queued reports
+        /*!
+         * Pops reports from the queue into m_readBuf and calls the read complete callback.
+         */
+        void dispatchThread();
+        //! Call the report or read complete callback with a report
+        /*!
+         * Used by the read loop, the dispatch thread and CallbackExecutor.
+         * \param buf       Report data, copied to m_readBuf for the read complete callback
+         * \param length    Number of bytes in buf
+         */
+        void deliverReport(const unsigned char *buf, size_t length);
 
 		/* XXX as it seems difficult? to relate fileReadIOComplete to a object
 		 * and call it's callbacks then maybe invoke callbacks from readThread()
@@ -170,42 +520,180 @@ class HidDevice
         unsigned char *m_readBuf = nullptr;
 
 	private:
+        //! Pass a report received by the read loop on to snapshots, queue or callback
+        /*!
+         * \param buf       Report data
+         * \param length    Number of bytes received
+         * \param now       HidClock receive time, 0 to take it here
+         */
+        void reportReceived(unsigned char *buf, size_t length, uint64_t now = 0);
+        //! deliverReport() with callbacks already taken by the caller
+        void deliverReport(const unsigned char *buf, size_t length, const Handlers &handlers);
+        //! Publish a copy of the callbacks with one of them replaced
+        template <typename F> void setHandler(F Handlers::*member, F cb)
+        {
+            std::lock_guard<std::mutex> lock(m_handlersMutex);
+            std::shared_ptr<Handlers> next = std::make_shared<Handlers>(*std::atomic_load(&m_handlers));
+            (*next).*member = cb;
+            std::atomic_store(&m_handlers, std::shared_ptr<const Handlers>(next));
+        }
+        //! The writes of writeBatch(), runs without m_submitMutex while m_batchActive is set
+        /*!
+         * \param submitted     Event of a submitWrite() report still in flight, NULL if none
+         */
+        bool writeBatchUnlocked(const void *reports, size_t count, size_t *failed, unsigned int depth,
+                                HANDLE submitted);
+        //! Wait for or cancel the write started by submitWrite(), caller holds m_submitMutex
+        /*!
+         * \param wait      true - wait for completion, false - only check if it completed
+         * \return          True if no write is in flight any more
+         */
+        bool finishSubmitted(bool wait);
+        //! Open the device handle and create events, without querying descriptor data
+        bool openHandle();
+        //! Open the device reusing descriptor data from a previous open()
+        bool reopen();
+        //! Take report lengths, attributes and strings from m_sim
+        bool openSimulated();
+        //! Read loop of a simulated device
+        /*!
+         * \param buf   Buffer to read into
+         */
+        void simulatedReadLoop(unsigned char *buf);
+        //! (Re)allocate m_readBuf for m_inputReportLength bytes
+        bool allocReadBuf();
+        //! Spin on the pending read for up to the adaptive budget
+        /*!
+         * \return          True if the read completed and its completion routine ran
+         */
+        bool spinRead();
+
+        //! Simulated device replacing the driver, null for real devices
+        std::shared_ptr<SimulatedDevice> m_sim;
+        //! Open state of a simulated device, which has no handle
+        bool m_simOpen = false;
+        //! Logger fed by the read loop, null if not logging
+        std::atomic<ReportLogger*> m_logger {nullptr};
+        //! Archive fed by the read loop, null if not recording
+        std::atomic<ReportArchiveWriter*> m_archive {nullptr};
+        //! Device ID in m_archive
+        uint32_t m_archiveDevice = 0;
+        //! Group reading the device on its reactor thread instead of m_readThread
+        std::atomic<HidDeviceGroup*> m_group {nullptr};
+        //! Set while m_group has the device registered
+        std::atomic<bool> m_attached {false};
+        //! Round-trip probe fed by the read loop, null if not probing
+        std::atomic<RoundTripProbe*> m_probe {nullptr};
 		//! Device handle
         HANDLE m_handle = INVALID_HANDLE_VALUE;
-		//! The HIDD_ATTRIBUTES structure contains vendor information about a HIDClass device
-		HIDD_ATTRIBUTES m_attributes;
 		//! Contains information used in asynchronous (or overlapped) input and output (I/O)
         OVERLAPPED m_overlapped;
+        //! Overlapped structure of the write started by submitWrite()
+        OVERLAPPED m_submitOverlapped;
+        //! Copy of the report being written by submitWrite()
+        std::vector<unsigned char> m_submitBuf;
+        //! Set while a write started by submitWrite() may still be in flight
+        bool m_submitPending = false;
+        //! Serializes submitWrite() callers
+        std::mutex m_submitMutex;
+        //! Set while writeBatch() writes without m_submitMutex, submitWrite() then reports busy
+        bool m_batchActive = false;
+        //! Signalled when writeBatch() clears m_batchActive
+        std::condition_variable m_batchDone;
+        //! Sends writeLatest() reports, created on first use
+        std::unique_ptr<WriteCoalescer> m_coalescer;
+        //! Protects m_coalescer
+        std::mutex m_coalescerMutex;
+        //! Reports m_coalescer failed to send
+        std::atomic<unsigned long long> m_failedWrites {0};
 		//! Specifies the maximum size, in bytes, of all the input reports (including the report ID, if report IDs are used, which is prepended to the report data)
         size_t m_inputReportLength = 0;
 		//! Specifies the maximum size, in bytes, of all the output reports (including the report ID, if report IDs are used, which is prepended to the report data)
         size_t m_outputReportLength = 0;
-        //! Device path
-        std::wstring m_path;
-        //! Serial number
-        std::wstring m_serialNumber;
-        //! Manufacturer
-        std::wstring m_manufacturer;
-        //! Product
-        std::wstring m_product;
-        //! Specifies the top-level collection's usage page
-		/*!
-		 * HID usages are organized into usage pages of related controls. A specific control usage is defined by its usage page, a usage ID, a name, and a description.
-		 * Examples of usage pages include Generic Desktop Controls, Game Controls, LEDs, Button, and so on. Examples of controls that are listed on the Generic Desktop
-		 * Controls usage page include pointers, mouse and keyboard devices, joysticks, and so on. A usage page value is a 16-bit unsigned value.
-		 */
-        unsigned short m_usagePage = 0;
-		//! Specifies a top-level collection's usage ID
-		/*!
-		 * In the context of a usage page, a valid usage identifier, or usage ID, is a positive integer greater than zero that indicates a usage in a usage page.
-		 * A usage ID of zero is reserved. A usage ID value is an unsigned 16-bit value.
-		 */
-		unsigned short m_usage = 0;
+        //! Device path handle, attributes, strings and usages live in the DeviceTable
+        DeviceId m_id = INVALID_DEVICE_ID;
 
 		//! Non-blocking read thread
 		std::thread m_readThread;
 		//! Non-blocking write thread
 		std::thread m_writeThread;
+        //! Queued report dispatch thread
+        std::thread m_dispatchThread;
+        //! Queue between the read loop and the dispatch thread, null if not queueing
+        /*!
+         * Only replaced by read() with m_configMutex held.
+         */
+        std::unique_ptr<ReportQueue> m_queue;
+        //! Buffer the read loop reads into while queueing
+        std::vector<unsigned char> m_ioBuf;
+        //! Reports dropped by queues of earlier reads, the current one is not included
+        std::atomic<unsigned long long> m_droppedReports {0};
+        //! Depth of m_queue, 0 disables queueing
+        size_t m_queueDepth = 0;
+        //! What to do when m_queue is full
+        OverflowPolicy m_overflowPolicy = OverflowPolicy::Block;
+        //! Latest report per report ID, null unless snapshot mode was enabled, atomic_load/atomic_store only
+        std::shared_ptr<ReportSnapshot> m_snapshots;
+        //! Determines if the read loop keeps snapshots, read by the read loop
+        std::atomic<bool> m_snapshotMode {false};
+        //! Shared memory ring reports are published to, null unless publishing
+        std::unique_ptr<ReportPublisher> m_publisher;
+        //! Name of the ring to publish to
+        std::wstring m_publisherName;
+        //! Number of reports the ring holds
+        size_t m_publisherSlots = 1024;
+        //! Window statistics, null unless aggregation was enabled
+        std::unique_ptr<ReportAggregator> m_aggregator;
+        //! Fields summarized by m_aggregator
+        ReportFieldTable m_aggregateFields;
+        //! Aggregation window length, 0 disables aggregation
+        unsigned long m_aggregateWindowUs = 0;
+        //! Time between sliding windows, 0 for tumbling windows
+        unsigned long m_aggregateHopUs = 0;
+        //! Compiled report filter, null if all reports pass
+        /*!
+         * Only replaced through std::atomic_store, the read loop may still
+         * evaluate the previous one.
+         */
+        std::shared_ptr<const ReportPredicate> m_reportFilter;
+        //! Number of reports rejected by m_reportFilter
+        std::atomic<unsigned long long> m_filteredReports {0};
+        //! Previous report per report ID, null unless the change filter is enabled
+        /*!
+         * Only replaced through std::atomic_store, the read loop may still
+         * hold the previous filter.
+         */
+        std::shared_ptr<ChangeFilter> m_changeFilter;
+        //! Determines if unchanged reports are suppressed
+        bool m_changeFilterEnabled = false;
+        //! Bits left out of change detection
+        std::vector<unsigned char> m_changeIgnoreMask;
+        //! Number of reports suppressed by m_changeFilter
+        std::atomic<unsigned long long> m_suppressedReports {0};
+        //! Executor running the callbacks while reading, null if not used
+        CallbackExecutor *m_executor = nullptr;
+        //! Executor to use from the next non-blocking read()
+        CallbackExecutor *m_pendingExecutor = nullptr;
+        //! Shard of m_executor the device is bound to
+        unsigned int m_executorShard = 0;
+        //! Requested by setExecutor(), stealing also needs a report callback
+        bool m_orderInsensitive = false;
+        //! Number of input reports buffered by the HID class driver
+        unsigned long m_numInputBuffers = 64;
+        //! Maximum time the read loop spins before blocking, 0 disables spinning
+        uint64_t m_spinBudgetNs = 0;
+        //! Current spin budget, adapted between m_spinBudgetNs / SPIN_BUDGET_MIN_DIV and m_spinBudgetNs
+        std::atomic<uint64_t> m_spinNs {0};
+        //! CPU the read thread is pinned to, -1 if not pinned
+        int m_readCpu = -1;
+        //! Reads completed while spinning
+        std::atomic<unsigned long long> m_spinHits {0};
+        //! Reads that blocked after spinning or without spinning
+        std::atomic<unsigned long long> m_blocks {0};
+        //! Time spent spinning
+        std::atomic<uint64_t> m_spinTotalNs {0};
+        //! Time spent waiting for reads, spinning or blocked
+        std::atomic<uint64_t> m_waitTotalNs {0};
 		//! Determines if read is blocking
 		bool m_readBlocking = true;
         //! Determines if read is continuous
@@ -217,13 +705,29 @@ class HidDevice
         bool m_connected = true;
         //! Set to true when closing to notify threads
         bool m_closing = false;
+        //! Determines if the device is reopened when reconnected
+        bool m_autoReconnect = false;
+        //! Set if report lengths, attributes and strings have been read
+        bool m_descriptorCached = false;
+        //! Set on removal if the device was open
+        bool m_resumeOpen = false;
+        //! Set on removal if continuous non-blocking reading was running
+        bool m_resumeRead = false;
+        //! Time of the pending automatic reconnect, 0 once a report has arrived
+        std::atomic<uint64_t> m_reconnectStart {0};
+        //! Reconnect-to-first-report latency of the last reconnect
+        std::atomic<uint64_t> m_reconnectLatency {0};
+        //! Number of automatic reconnects
+        unsigned long m_reconnects = 0;
 
-		//! User-defined callback for device removal
-		std::function<void(HidDevice*)> m_callbackRemoval = nullptr;
-        //! User-defined callback for read complete
-        std::function<void(HidDevice*)> m_callbackReadComplete = nullptr;
-        //! User-defined callback for write complete
-        std::function<void(HidDevice*)> m_callbackWriteComplete = nullptr;
+        //! User-defined callbacks, only replaced through std::atomic_store
+        std::shared_ptr<const Handlers> m_handlers = std::make_shared<Handlers>();
+        //! Serializes callback setters
+        std::mutex m_handlersMutex;
+        //! Serializes live changes to the change filter and queue, and access to m_queue, with read() and close()
+        std::mutex m_configMutex;
+        //! Set between a non-blocking read() and close(), filter changes then apply at once
+        bool m_streaming = false;
 };
 
 #endif // HIDDEVICE_H
@@ -0,0 +1,137 @@
+#ifndef HIDDEVICEGROUP_H
+#define HIDDEVICEGROUP_H
+
+#include <windows.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "devicetable.h"
+
+class HidDevice;
+
+//! HidDeviceGroup class
+/*!
+ * The top-level collections of one physical device. Windows exposes every
+ * collection of a composite device as a separate HidDevice; HidApi groups
+ * them by container ID, or by parent device node for devices built into
+ * the computer, so they can be handled as one logical device.
+ *
+ * read() registers all collections with a single reactor thread, which keeps
+ * a read in flight on every collection and waits for all of them in one
+ * alertable wait, instead of running a read thread per collection. Reports
+ * of all collections are time stamped on that thread from one clock, so the
+ * merged stream and the per-collection pipelines share a common timeline.
+ */
+
+class HidDeviceGroup
+{
+    public:
+        //! Callback taking a report of any collection and its HidClock receive time
+        typedef std::function<void(HidDevice*, const unsigned char*, size_t, uint64_t)> ReportCallback;
+
+        //! \param container    Container of the collections, a DeviceTable string
+        HidDeviceGroup(StringId container);
+        //! Stops reading, the collections stay open
+        ~HidDeviceGroup();
+
+        //! Get the container of the collections
+        StringId getContainer() const {return m_container;}
+        //! Get the collections in the order they were found
+        std::vector<HidDevice*> getDevices();
+        //! Get the collection with the given top-level usage, null if there is none
+        HidDevice *getCollection(unsigned short usagePage, unsigned short usage);
+
+        //! Open all collections
+        /*!
+         * \return      False if a collection could not be opened, the others stay open
+         */
+        bool open();
+        //! Stop reading and close all open collections
+        /*!
+         * Not to be called from a callback running on the reactor thread.
+         */
+        bool close();
+        //! Start reading all open collections on the reactor thread
+        /*!
+         * Collections are switched to continuous non-blocking reading and
+         * pass reports to their own queues, filters and callbacks as usual.
+         * A collection reconnected after a removal rejoins the group.
+         * \return      False if a collection is not open
+         */
+        bool read();
+        //! True while the reactor thread runs
+        bool isReading() {return m_running;}
+
+        //! Set the function called with the reports of all collections, in arrival order
+        /*!
+         * Called on the reactor thread before the collection's own pipeline.
+         * Takes effect with the next report, also while reading.
+         */
+        void setCallbackReport(ReportCallback cb)
+            {std::atomic_store(&m_callbackReport, std::shared_ptr<const ReportCallback>(std::make_shared<ReportCallback>(cb)));}
+        //! Number of reports received from all collections
+        unsigned long long getReports() {return m_reports;}
+
+    private:
+        friend class HidApi;
+        friend class HidDevice;
+        struct Slot;
+
+        //! Add a collection, called by HidApi
+        void add(HidDevice *device);
+        //! Register a collection with the reactor, called by HidDevice::read()
+        void attach(HidDevice *device);
+        //! Unregister a collection, returns once no read is in flight on it
+        /*!
+         * Called by HidDevice::close() before the handle is closed. From the
+         * reactor thread itself, e.g. in a callback, it returns at once and
+         * closing the handle aborts the read.
+         */
+        void detach(HidDevice *device);
+        //! Stop the reactor thread and release the collections
+        void stop();
+
+        void reactor();
+        //! Apply attach and detach requests, returns true once the reactor may exit
+        bool applyRequests();
+        //! Start an overlapped read on a collection
+        void issue(Slot *slot);
+        //! Pass a report on to the group callback and the collection
+        /*!
+         * \param now       HidClock receive time, 0 to take it here
+         */
+        void deliver(Slot *slot, size_t length, uint64_t now = 0);
+        static VOID WINAPI readComplete(DWORD error, DWORD bytes, LPOVERLAPPED overlapped);
+
+        StringId m_container;
+        //! Protects m_devices, m_requests, m_stopping and starting the reactor
+        std::mutex m_mutex;
+        //! Signalled when the reactor drops a collection
+        std::condition_variable m_detached;
+        std::vector<HidDevice*> m_devices;
+        //! Attach (true) and detach (false) requests for the reactor
+        std::vector<std::pair<HidDevice*, bool>> m_requests;
+        //! Collections being read, only touched by the reactor thread
+        std::vector<std::unique_ptr<Slot>> m_slots;
+        //! Auto-reset event waking the reactor for requests and simulated reports
+        HANDLE m_wake;
+        bool m_stopping = false;
+        std::atomic<bool> m_running {false};
+        std::thread m_thread;
+        //! Lets detach() tell if it is called from the reactor thread
+        std::thread::id m_reactorId;
+
+        //! Only replaced through std::atomic_store, the reactor may be calling the previous one
+        std::shared_ptr<const ReportCallback> m_callbackReport = std::make_shared<ReportCallback>();
+        std::atomic<unsigned long long> m_reports {0};
+};
+
+#endif // HIDDEVICEGROUP_H
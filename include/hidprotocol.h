@@ -0,0 +1,143 @@
+#ifndef HIDPROTOCOL_H
+#define HIDPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Framing used between HidServer and HidClient over a local stream socket.
+ * Every message is a HidFrameHeader followed by length payload bytes. Frames
+ * carrying reports (HID_MSG_REPORTS, HID_MSG_WRITE) hold count records of
+ * {uint32 device, uint16 length, data}, so many reports travel in a single
+ * frame. Integers are in host byte order, both ends run on the same machine.
+ */
+
+#define HID_PROTOCOL_VERSION 1
+//! Largest payload accepted in a frame
+#define HID_FRAME_MAX (1 << 20)
+
+enum HidMessageType
+{
+    //! Client asks for the device list, empty payload
+    HID_MSG_ENUMERATE = 1,
+    //! Server sends count device descriptions
+    HID_MSG_DEVICES,
+    //! Client opens a device: uint32 device
+    HID_MSG_OPEN,
+    //! Server answers HID_MSG_OPEN: uint32 device, uint8 success
+    HID_MSG_OPENED,
+    //! Client closes a device: uint32 device
+    HID_MSG_CLOSE,
+    //! Client writes count output reports
+    HID_MSG_WRITE,
+    //! Server forwards count input reports
+    HID_MSG_REPORTS,
+    //! Server announces an arrived device, one device description
+    HID_MSG_ARRIVAL,
+    //! Server announces a removed device: uint32 device
+    HID_MSG_REMOVAL
+};
+
+struct HidFrameHeader
+{
+    uint32_t length;
+    uint16_t type;
+    uint16_t count;
+};
+
+//! Static description of a device as sent by the server
+struct HidDeviceInfo
+{
+    uint32_t id = 0;
+    uint16_t vid = 0;
+    uint16_t pid = 0;
+    uint16_t versionNumber = 0;
+    uint16_t usagePage = 0;
+    uint16_t usage = 0;
+    uint16_t inputReportLength = 0;
+    uint16_t outputReportLength = 0;
+    bool connected = false;
+    std::wstring path;
+    std::wstring manufacturer;
+    std::wstring product;
+    std::wstring serialNumber;
+};
+
+//! HidFrameWriter class
+/*!
+ * Builds frames into a byte buffer. Several frames may be appended to the
+ * same buffer and sent with a single call.
+ */
+
+class HidFrameWriter
+{
+    public:
+        explicit HidFrameWriter(std::vector<unsigned char> &buf) : m_buf(buf) {}
+
+        //! Start a new frame, finished by the next begin() or end()
+        void begin(uint16_t type);
+        //! Continue appending to the frame starting at offset start
+        void resume(size_t start) {m_start = start;}
+        //! Count one more record in the current frame
+        void record() {header()->count++;}
+        //! Number of records in the current frame
+        uint16_t count() {return header()->count;}
+        //! Bytes in the current frame so far, header included
+        size_t size() const {return m_buf.size() - m_start;}
+        //! Finish the current frame
+        void end();
+
+        void put(const void *data, size_t length);
+        void put8(uint8_t v) {put(&v, sizeof(v));}
+        void put16(uint16_t v) {put(&v, sizeof(v));}
+        void put32(uint32_t v) {put(&v, sizeof(v));}
+        void putString(const std::wstring &s);
+        //! Append a report record {device, length, data} and count it
+        void putReport(uint32_t device, const unsigned char *report, size_t length);
+        void putDeviceInfo(const HidDeviceInfo &info);
+
+    private:
+        HidFrameHeader *header() {return (HidFrameHeader*)&m_buf[m_start];}
+
+        std::vector<unsigned char> &m_buf;
+        //! Offset of the current frame header
+        size_t m_start = 0;
+};
+
+//! HidFrameReader class
+/*!
+ * Reads fields from a frame payload, failing instead of reading past its end.
+ */
+
+class HidFrameReader
+{
+    public:
+        HidFrameReader(const unsigned char *data, size_t length) : m_data(data), m_length(length) {}
+
+        bool get(void *data, size_t length);
+        bool get8(uint8_t &v) {return get(&v, sizeof(v));}
+        bool get16(uint16_t &v) {return get(&v, sizeof(v));}
+        bool get32(uint32_t &v) {return get(&v, sizeof(v));}
+        bool getString(std::wstring &s);
+        //! Read a report record in place
+        bool getReport(uint32_t &device, const unsigned char *&report, size_t &length);
+        bool getDeviceInfo(HidDeviceInfo &info);
+
+    private:
+        const unsigned char *m_data;
+        size_t m_length;
+        size_t m_pos = 0;
+};
+
+//! Send all bytes on a socket
+bool hidSendAll(uintptr_t socket, const unsigned char *data, size_t length);
+//! Receive one complete frame from a socket
+/*!
+ * \return      False on disconnect or malformed frame
+ */
+bool hidRecvFrame(uintptr_t socket, HidFrameHeader &header, std::vector<unsigned char> &payload);
+
+#endif // HIDPROTOCOL_H
@@ -0,0 +1,121 @@
+#ifndef HIDSERVER_H
+#define HIDSERVER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hidapi.h"
+#include "hidprotocol.h"
+
+//! Bytes buffered for a client before further input reports are dropped
+#define HID_CLIENT_BUFFER_MAX (4 << 20)
+
+//! HidServer class
+/*!
+ * Serves the devices of an HidApi to other processes over a Unix domain
+ * socket (AF_UNIX, Windows 10 1803 and later). Clients enumerate devices,
+ * open them, write output reports and receive input reports and hotplug
+ * events, see hidprotocol.h for the framing.
+ *
+ * A device is opened and read continuously while at least one client has it
+ * open. Input reports are appended to a per-client buffer and sent by the
+ * client's sender thread; reports arriving while a send is in progress are
+ * batched into a single frame.
+ *
+ * The server installs its own arrival and removal callbacks on the HidApi.
+ */
+
+class HidServer
+{
+    public:
+        explicit HidServer(HidApi &api);
+        //! Stops the server and disconnects all clients
+        ~HidServer();
+
+        //! Listen on a socket path and start accepting clients
+        /*!
+         * \param socketPath    File system path of the socket, replaced if it exists
+         * \return              False if the socket could not be created
+         */
+        bool start(const std::string &socketPath);
+        //! Stop accepting clients and disconnect all clients
+        void stop();
+
+    private:
+        struct Client
+        {
+            uintptr_t socket;
+            std::thread reader;
+            std::thread sender;
+            std::mutex mutex;
+            std::condition_variable cv;
+            //! Bytes waiting to be sent
+            std::vector<unsigned char> out;
+            //! Offset of the last frame in out if it is an open HID_MSG_REPORTS frame
+            size_t reportsFrame = SIZE_MAX;
+            //! Devices the client has opened
+            std::set<uint32_t> opened;
+            bool closing = false;
+            //! Set by the reader thread once it has cleaned up
+            bool done = false;
+        };
+
+        struct Device
+        {
+            HidDevice *device;
+            //! Clients that have the device open
+            std::set<Client*> clients;
+        };
+
+        void acceptThread();
+        //! Handle requests from one client until it disconnects
+        void readerThread(Client *c);
+        //! Send what accumulates in the client's buffer
+        void senderThread(Client *c);
+        //! Handle one request
+        /*!
+         * \param lock      Holds m_mutex, released while writing to devices
+         */
+        void handle(Client *c, const HidFrameHeader &h, const std::vector<unsigned char> &payload,
+                    std::unique_lock<std::mutex> &lock);
+        //! Forward a report to all clients that have the device open
+        /*!
+         * Called from device read loops, only takes m_subscribersMutex.
+         */
+        void report(uint32_t id, const unsigned char *data, size_t length);
+        //! Send a complete frame to a client
+        void queueFrame(Client *c, const std::vector<unsigned char> &frame);
+        //! Remove a client from a device, closing the device if it was the last one, caller holds m_mutex
+        void detach(Client *c, uint32_t id);
+        //! ID of a device, assigning one if it has none, caller holds m_mutex
+        uint32_t idOf(HidDevice *d);
+        //! Description of a device for clients
+        HidDeviceInfo info(uint32_t id, HidDevice *d);
+        //! Join and delete clients whose reader has finished, caller holds m_mutex
+        void reap();
+
+        HidApi &m_api;
+        uintptr_t m_listen;
+        std::string m_socketPath;
+        std::thread m_acceptThread;
+        bool m_stopping = false;
+
+        //! Protects m_devices, m_ids and m_clients
+        std::mutex m_mutex;
+        //! Protects Device::clients, never held while opening or closing devices
+        std::mutex m_subscribersMutex;
+        std::map<uint32_t, Device> m_devices;
+        std::map<HidDevice*, uint32_t> m_ids;
+        uint32_t m_nextId = 1;
+        std::list<std::unique_ptr<Client>> m_clients;
+};
+
+#endif // HIDSERVER_H
@@ -0,0 +1,77 @@
+#ifndef HIDTRACE_H
+#define HIDTRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+//! HidTrace class
+/*!
+ * Process-wide timeline tracer for I/O, callbacks and hotplug handling.
+ * Every thread records into its own fixed-size ring buffer, so recording
+ * takes no locks and the newest events are kept when a buffer wraps.
+ * While stopped, recording costs a single relaxed atomic load. The timeline
+ * is exported as Chrome trace-event JSON, which chrome://tracing and
+ * Perfetto open directly.
+ */
+
+class HidTrace
+{
+    public:
+        //! Clear all buffers and start recording
+        /*!
+         * \param eventsPerThread   Ring buffer size of every thread, applies to buffers created from now on
+         */
+        static void start(size_t eventsPerThread = 65536);
+        //! Stop recording, buffers are kept for dump()
+        static void stop();
+        //! Check if recording
+        static bool enabled() {return s_enabled.load(std::memory_order_relaxed);}
+
+        //! Record a completed span
+        /*!
+         * \param name      Event name, must be a string literal or otherwise outlive the trace
+         * \param category  Event category, same lifetime requirement as name
+         * \param start     Start time in HidClock nanoseconds
+         * \param end       End time in HidClock nanoseconds
+         * \param id        Object the event belongs to, e.g. a device, shown as an argument
+         */
+        static void span(const char *name, const char *category, uint64_t start, uint64_t end, const void *id = nullptr);
+        //! Record a point in time
+        static void instant(const char *name, const char *category, const void *id = nullptr);
+
+        //! Write all recorded events as Chrome trace-event JSON
+        /*!
+         * Stop recording first for a consistent timeline, events recorded
+         * while dumping may come out torn.
+         * \return          False if writing failed
+         */
+        static bool dump(std::ostream &out);
+        //! Write all recorded events to a file
+        static bool dump(const std::string &path);
+
+    private:
+        static std::atomic<bool> s_enabled;
+};
+
+//! HidTraceScope class
+/*!
+ * Records the lifetime of the object as a span if tracing was enabled when it was created.
+ */
+
+class HidTraceScope
+{
+    public:
+        HidTraceScope(const char *name, const char *category, const void *id = nullptr);
+        ~HidTraceScope();
+
+    private:
+        const char *m_name;
+        const char *m_category;
+        const void *m_id;
+        uint64_t m_start;
+};
+
+#endif // HIDTRACE_H
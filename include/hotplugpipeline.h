@@ -0,0 +1,88 @@
+#ifndef HOTPLUGPIPELINE_H
+#define HOTPLUGPIPELINE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "devicetable.h"
+
+//! HotplugPipeline class
+/*!
+ * Takes device arrival and removal notifications off the notification
+ * thread. Events are held for a debounce interval per device, so a
+ * device that is removed and added again in quick succession yields a
+ * single event with its final state. Ready events are handled in batches
+ * by a pool of worker threads; once every event of a batch has been
+ * handled the batch complete function is called.
+ */
+
+class HotplugPipeline
+{
+    public:
+        //! Handles one coalesced event on a worker thread
+        /*!
+         * Arguments are the device, whether the device is present after
+         * the events and whether a removal was among the coalesced events.
+         */
+        typedef std::function<void(DeviceId, bool, bool)> Handler;
+
+        //! Starts the coordinator and worker threads
+        /*!
+         * \param workers       Number of worker threads
+         * \param handler       Called for every coalesced event
+         * \param batchComplete Called on the coordinator thread after each batch
+         */
+        HotplugPipeline(unsigned int workers, Handler handler, std::function<void()> batchComplete);
+        //! Stops all threads, events not yet handled are discarded
+        ~HotplugPipeline();
+
+        //! Queue a notification, returns immediately
+        /*!
+         * \param device    Interned device path
+         * \param present   true - arrival, false - removal
+         */
+        void post(DeviceId device, bool present);
+        //! Set how long events for a device are held waiting for more (100 ms by default)
+        void setDebounce(unsigned int ms);
+
+    private:
+        struct Pending
+        {
+            bool present;
+            bool sawRemoval;
+            uint64_t deadline;
+        };
+
+        void coordinator();
+        void worker();
+
+        Handler m_handler;
+        std::function<void()> m_batchComplete;
+
+        std::mutex m_mutex;
+        //! Wakes the coordinator on new events
+        std::condition_variable m_eventCv;
+        //! Wakes workers on new tasks
+        std::condition_variable m_taskCv;
+        //! Wakes the coordinator when a batch is done
+        std::condition_variable m_doneCv;
+        //! Events waiting for their debounce interval to pass, by device
+        std::map<DeviceId, Pending> m_pending;
+        //! Events of the current batch not yet taken by a worker
+        std::deque<std::pair<DeviceId, Pending>> m_tasks;
+        //! Events of the current batch not yet handled
+        size_t m_unfinished = 0;
+        uint64_t m_debounceNs = 100000000;
+        bool m_stopping = false;
+
+        std::thread m_coordinator;
+        std::vector<std::thread> m_workers;
+};
+
+#endif // HOTPLUGPIPELINE_H
@@ -0,0 +1,81 @@
+#ifndef HOTPLUGSOURCE_H
+#define HOTPLUGSOURCE_H
+
+#include <windows.h>
+#include <cfgmgr32.h>
+
+#include <functional>
+#include <string>
+
+//! HotplugSource class
+/*!
+ * Source of HID device arrival and removal notifications. HidApi starts the
+ * source with a sink taking the device path and whether the device arrived
+ * (true) or was removed (false). The sink may be called from any thread.
+ */
+
+class HotplugSource
+{
+    public:
+        typedef std::function<void(const std::wstring&, bool)> Sink;
+
+        virtual ~HotplugSource() {}
+
+        //! Start delivering notifications to sink
+        /*!
+         * \return      False if notifications cannot be received
+         */
+        virtual bool start(Sink sink) = 0;
+        //! Stop delivering notifications, returns once the sink is no longer called
+        virtual void stop() = 0;
+};
+
+//! DeviceInterfaceSource class
+/*!
+ * Receives HID interface arrivals and removals from the configuration
+ * manager (CM_Register_Notification). Notifications are delivered on a
+ * system thread pool thread, so no window, message loop or thread of our
+ * own is needed.
+ */
+
+class DeviceInterfaceSource : public HotplugSource
+{
+    public:
+        ~DeviceInterfaceSource();
+
+        bool start(Sink sink);
+        void stop();
+
+    private:
+        //! Receives the configuration manager notification and passes it to the sink
+        static DWORD CALLBACK s_notify(HCMNOTIFICATION hNotify, PVOID context, CM_NOTIFY_ACTION action,
+                                       PCM_NOTIFY_EVENT_DATA data, DWORD size);
+
+        Sink m_sink;
+        HCMNOTIFICATION m_notification = NULL;
+};
+
+//! SyntheticHotplugSource class
+/*!
+ * Delivers only the notifications passed to inject(), for testing hotplug
+ * handling without plugging devices.
+ */
+
+class SyntheticHotplugSource : public HotplugSource
+{
+    public:
+        bool start(Sink sink) {m_sink = sink; return true;}
+        void stop() {m_sink = nullptr;}
+
+        //! Deliver a notification as if it came from the system
+        /*!
+         * \param path      Device path
+         * \param present   true - arrival, false - removal
+         */
+        void inject(const std::wstring &path, bool present) {if (m_sink) m_sink(path, present);}
+
+    private:
+        Sink m_sink;
+};
+
+#endif // HOTPLUGSOURCE_H
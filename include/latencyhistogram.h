@@ -0,0 +1,62 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! Sub-buckets per power of two are 1 << (HISTOGRAM_PRECISION_BITS - 1), i.e. under 1% error
+#define HISTOGRAM_PRECISION_BITS 8
+//! Largest value told apart from larger ones, about 73 minutes in nanoseconds
+#define HISTOGRAM_MAX_BITS 42
+
+//! LatencyHistogram class
+/*!
+ * Log-linear histogram in the style of HdrHistogram: every power of two is
+ * split into equally wide sub-buckets, so percentiles keep the same relative
+ * precision from nanoseconds to minutes in a fixed amount of memory.
+ * Recording is a few shifts and an increment, not thread-safe.
+ */
+
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram();
+
+        //! Count one value, values above the range are counted in the last bucket
+        void record(uint64_t value);
+        //! Add the counts of another histogram
+        void merge(const LatencyHistogram &other);
+        //! Remove all values
+        void reset();
+
+        //! Number of recorded values
+        unsigned long long count() const {return m_count;}
+        //! Smallest recorded value, exact
+        uint64_t min() const {return m_count ? m_min : 0;}
+        //! Largest recorded value, exact
+        uint64_t max() const {return m_max;}
+        //! Mean of the recorded values, exact
+        double mean() const {return m_count ? double(m_sum) / m_count : 0.0;}
+        //! Value at or below which the given percentage of values fall
+        /*!
+         * \param p     Percentile, 0 to 100, e.g. 99.9
+         * \return      Upper bound of the bucket holding the percentile, at most max()
+         */
+        uint64_t percentile(double p) const;
+
+    private:
+        //! Bucket holding a value
+        static size_t bucketOf(uint64_t value);
+        //! Largest value falling into a bucket
+        static uint64_t upperBound(size_t bucket);
+
+        std::vector<unsigned long long> m_buckets;
+        unsigned long long m_count = 0;
+        uint64_t m_min = 0;
+        uint64_t m_max = 0;
+        //! Sum of all values, for the mean
+        uint64_t m_sum = 0;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,116 @@
+#ifndef OUTPUTSCHEDULER_H
+#define OUTPUTSCHEDULER_H
+
+#include <windows.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "hiddevice.h"
+
+//! OutputScheduler class
+/*!
+ * Sends output reports to any number of devices at fixed periods from a
+ * single thread. Streams are served in deadline order, the thread sleeps on
+ * a high resolution waitable timer in between. For every stream the
+ * scheduler records how late each report was submitted and how many
+ * deadlines were missed.
+ */
+
+class OutputScheduler
+{
+    public:
+        //! Per-stream timing statistics
+        struct Stats
+        {
+            //! Reports submitted to the device
+            unsigned long long sent = 0;
+            //! Periods skipped because the scheduler fell behind by more than a period
+            unsigned long long missed = 0;
+            //! Deadlines at which the device was still busy with the previous report or closed
+            unsigned long long busy = 0;
+            //! Sum of submission delays after the deadline, in nanoseconds
+            uint64_t jitterSumNs = 0;
+            //! Largest submission delay after the deadline, in nanoseconds
+            uint64_t jitterMaxNs = 0;
+
+            //! Average submission delay after the deadline, in nanoseconds
+            uint64_t jitterMeanNs() const {return sent ? jitterSumNs / sent : 0;}
+        };
+
+        //! Creates the timer, call start() to begin sending
+        OutputScheduler();
+        //! Stops the scheduler thread
+        ~OutputScheduler();
+
+        //! Register a periodic output report
+        /*!
+         * \param device    Open device to write to
+         * \param report    Report data, copied
+         * \param length    Number of bytes in report
+         * \param periodUs  Period in microseconds
+         * \return          Stream ID, or -1 if the period is zero
+         */
+        int add(HidDevice *device, const unsigned char *report, size_t length, unsigned long periodUs);
+        //! Replace the report data of a stream, sent from its next deadline on
+        /*!
+         * \return          False if there is no such stream
+         */
+        bool update(int id, const unsigned char *report, size_t length);
+        //! Stop sending a stream
+        /*!
+         * \return          False if there is no such stream
+         */
+        bool remove(int id);
+        //! Get the statistics of a stream
+        /*!
+         * \return          False if there is no such stream
+         */
+        bool stats(int id, Stats &s);
+
+        //! Start the scheduler thread
+        void start();
+        //! Stop the scheduler thread, streams are kept
+        void stop();
+
+    private:
+        struct Stream
+        {
+            HidDevice *device;
+            std::vector<unsigned char> report;
+            uint64_t periodNs;
+            uint64_t deadline;
+            Stats stats;
+        };
+        struct Deadline
+        {
+            uint64_t time;
+            int id;
+            bool operator>(const Deadline &o) const {return time > o.time;}
+        };
+
+        //! Scheduler thread
+        void run();
+        //! Send one due stream and schedule its next deadline, caller holds m_mutex
+        void serve(Stream &s, uint64_t now);
+
+        std::mutex m_mutex;
+        std::map<int, Stream> m_streams;
+        //! Earliest deadline first, may hold entries of removed streams
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> m_deadlines;
+        int m_nextId = 0;
+
+        std::thread m_thread;
+        bool m_stopping = false;
+        //! Waitable timer armed for the earliest deadline
+        HANDLE m_timer = NULL;
+        //! Wakes the thread when streams change or on stop
+        HANDLE m_wakeEvent = NULL;
+};
+
+#endif // OUTPUTSCHEDULER_H
@@ -0,0 +1,95 @@
+#ifndef REPORTAGGREGATOR_H
+#define REPORTAGGREGATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "reportfield.h"
+
+//! Summary of one field over a window
+struct FieldAggregate
+{
+    //! Number of reports containing the field
+    unsigned long long count = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+    int64_t sum = 0;
+    //! Value in the most recent report
+    int64_t last = 0;
+
+    double mean() const {return count ? double(sum) / count : 0.0;}
+};
+
+//! Summary of all fields over a window
+struct ReportAggregate
+{
+    //! Window start in HidClock nanoseconds
+    uint64_t start = 0;
+    //! Window end in HidClock nanoseconds, exclusive
+    uint64_t end = 0;
+    //! Number of reports in the window
+    unsigned long long count = 0;
+    //! One entry per field of the field table, in table order
+    std::vector<FieldAggregate> fields;
+};
+
+//! ReportAggregator class
+/*!
+ * Reduces a stream of reports to per-field min/max/mean/last summaries over
+ * time windows. Windows are tumbling (back to back) or sliding (overlapping,
+ * one every hop). Sliding windows are built from hop-sized panes, so a report
+ * is only folded into a single pane no matter how many windows overlap it.
+ * A window is emitted when the first report after its end arrives, or by flush().
+ */
+
+class ReportAggregator
+{
+    public:
+        //! Called with every window holding at least one report
+        typedef std::function<void(const ReportAggregate&)> Callback;
+
+        /*!
+         * \param fields    Fields to summarize
+         * \param windowUs  Window length in microseconds, rounded up to a multiple of hopUs
+         * \param hopUs     Time between sliding windows, 0 for tumbling windows
+         * \param cb        Callback taking each finished window
+         */
+        ReportAggregator(const ReportFieldTable &fields, uint64_t windowUs, uint64_t hopUs, Callback cb);
+
+        //! Fold a report into the current pane, emitting the windows that ended before it
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         * \param time      Arrival time in HidClock nanoseconds, non-decreasing
+         */
+        void add(const unsigned char *report, size_t length, uint64_t time);
+        //! Emit the window ending with the current pane early and start over
+        void flush();
+
+    private:
+        struct Pane
+        {
+            //! Pane number since the first report, -1 if unused
+            int64_t index = -1;
+            unsigned long long count = 0;
+            std::vector<FieldAggregate> fields;
+        };
+
+        //! Emit the window made of the panes up to and including pane last
+        void emit(int64_t last);
+
+        ReportFieldTable m_table;
+        //! Field indices per report ID
+        std::vector<std::vector<size_t>> m_fieldsOfId;
+        std::vector<Pane> m_panes;
+        uint64_t m_hopNs;
+        uint64_t m_origin = 0;
+        int64_t m_current = -1;
+        Callback m_callback;
+        //! Reused for every emitted window
+        ReportAggregate m_out;
+};
+
+#endif // REPORTAGGREGATOR_H
@@ -0,0 +1,154 @@
+#ifndef REPORTARCHIVE_H
+#define REPORTARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Reports per block unless configured otherwise
+#define ARCHIVE_BLOCK_REPORTS 4096
+
+//! Location of one block in an archive
+struct ArchiveBlockInfo
+{
+    uint32_t device;
+    unsigned char reportId;
+    uint32_t count;
+    uint64_t firstTime;
+    uint64_t lastTime;
+    //! File offset of the block header
+    uint64_t offset;
+};
+
+//! ReportArchiveWriter class
+/*!
+ * Long-term storage for captured report streams. Reports are grouped per
+ * device and report ID into blocks of a few thousand and stored column by
+ * column: delta-encoded time stamps, lengths, and payloads XORed with the
+ * previous report and transposed so that unchanged bytes line up into long
+ * zero runs for a simple run-length coder. A block index by time is written
+ * on close(), so readers can decode a time range without scanning the file.
+ * Archives not closed properly can still be read by scanning.
+ */
+
+class ReportArchiveWriter
+{
+    public:
+        /*!
+         * \param blockReports  Reports per block
+         */
+        ReportArchiveWriter(size_t blockReports = ARCHIVE_BLOCK_REPORTS);
+        //! Closes the archive
+        ~ReportArchiveWriter();
+
+        //! Create an archive, replacing an existing file
+        /*!
+         * \return          False if the file could not be created
+         */
+        bool open(const std::string &path);
+        //! Write pending blocks and the index
+        /*!
+         * \return          False if writing failed
+         */
+        bool close();
+
+        //! Get the ID of a device, registering it on first use
+        /*!
+         * \param name      Device name, e.g. its path
+         * \return          ID to pass to append()
+         */
+        uint32_t device(const std::wstring &name);
+        //! Add a report, safe to call from any number of threads
+        /*!
+         * \param device    ID returned by device()
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         * \param time      Time stamp in HidClock nanoseconds
+         * \return          False if the archive is not open or writing failed
+         */
+        bool append(uint32_t device, const unsigned char *report, size_t length, uint64_t time);
+
+        //! Bytes of report data appended
+        unsigned long long rawBytes() {return m_rawBytes;}
+        //! Bytes written to the file
+        unsigned long long fileBytes() {return m_offset;}
+
+    private:
+        struct Stream
+        {
+            std::vector<uint64_t> times;
+            std::vector<uint32_t> lengths;
+            std::vector<unsigned char> data;
+        };
+
+        //! Encode and write the block of a stream, caller holds m_mutex
+        bool flush(uint32_t device, unsigned char reportId, Stream &s);
+        //! Write bytes at the end of the file, caller holds m_mutex
+        bool put(const std::vector<unsigned char> &bytes);
+
+        std::mutex m_mutex;
+        std::FILE *m_file = nullptr;
+        uint64_t m_offset = 0;
+        size_t m_blockReports;
+        std::map<std::wstring, uint32_t> m_devices;
+        //! Streams by device ID << 8 | report ID
+        std::map<uint64_t, Stream> m_streams;
+        std::vector<ArchiveBlockInfo> m_index;
+        unsigned long long m_rawBytes = 0;
+        bool m_failed = false;
+};
+
+//! ReportArchiveReader class
+/*!
+ * Reads archives written by ReportArchiveWriter.
+ */
+
+class ReportArchiveReader
+{
+    public:
+        //! Called with every report of a range, return false to stop
+        typedef std::function<bool(uint64_t time, const unsigned char *report, size_t length)> Visitor;
+
+        ~ReportArchiveReader();
+
+        //! Open an archive and load its index, scanning the file if it has none
+        /*!
+         * \return          False if the file is not an archive
+         */
+        bool open(const std::string &path);
+        void close();
+
+        //! Names of the devices in the archive, the index being the device ID
+        const std::vector<std::wstring> &devices() const {return m_devices;}
+        //! All blocks in the archive
+        const std::vector<ArchiveBlockInfo> &blocks() const {return m_blocks;}
+
+        //! Visit the reports of one device in a time range, in time order
+        /*!
+         * Only blocks overlapping the range are read and decoded.
+         * \param device    Device ID
+         * \param from      Start time, inclusive
+         * \param to        End time, inclusive
+         * \param visit     Callback taking each report
+         * \return          False if a block could not be read
+         */
+        bool read(uint32_t device, uint64_t from, uint64_t to, Visitor visit);
+
+    private:
+        //! Rebuild the device table and index from the records, for archives without index
+        bool scan();
+        //! Decode the block at offset into times, lengths and concatenated reports
+        bool decode(uint64_t offset, std::vector<uint64_t> &times,
+                    std::vector<uint32_t> &lengths, std::vector<unsigned char> &data);
+
+        std::FILE *m_file = nullptr;
+        std::vector<std::wstring> m_devices;
+        std::vector<ArchiveBlockInfo> m_blocks;
+};
+
+#endif // REPORTARCHIVE_H
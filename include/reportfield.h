@@ -0,0 +1,93 @@
+#ifndef REPORTFIELD_H
+#define REPORTFIELD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! ReportField struct
+/*!
+ * A value in an input report, located by bit position. Offsets count from
+ * the start of the buffer returned by a read, i.e. the report ID byte is
+ * bits 0 to 7 whether or not the device uses report IDs.
+ */
+
+struct ReportField
+{
+    //! Report ID of the reports containing the field
+    unsigned char reportId = 0;
+    //! Usage page of the field
+    unsigned short usagePage = 0;
+    //! Usage of the field
+    unsigned short usage = 0;
+    //! Position of the least significant bit
+    unsigned int bitOffset = 0;
+    //! Width in bits, 1 to 32
+    unsigned int bitSize = 0;
+    //! Determines if the value is two's complement (negative logical minimum)
+    bool isSigned = false;
+
+    //! Extract the value of the field from a report
+    /*!
+     * \param report    Report data
+     * \param length    Number of bytes in report
+     * \return          Value, 0 if the report is too short, has another report ID or bitSize is invalid
+     */
+    int64_t value(const unsigned char *report, size_t length) const
+    {
+        if (!length || report[0] != reportId || bitSize < 1 || bitSize > 32
+                || bitOffset + bitSize > length * 8)
+            return 0;
+        unsigned int first = bitOffset / 8;
+        unsigned int shift = bitOffset % 8;
+        unsigned int bytes = (shift + bitSize + 7) / 8;
+        uint64_t v = 0;
+        for (unsigned int i = 0; i < bytes; i++)
+            v |= uint64_t(report[first + i]) << (8 * i);
+        v = (v >> shift) & ((uint64_t(1) << bitSize) - 1);
+        if (isSigned && (v >> (bitSize - 1)))
+            return int64_t(v) - (int64_t(1) << bitSize);
+        return int64_t(v);
+    }
+};
+
+//! ReportFieldTable class
+/*!
+ * Field table of the input reports of a device, filled from a report
+ * descriptor or by hand. Windows only exposes preparsed data, which lacks
+ * bit positions, so the descriptor has to come from the device documentation
+ * or a USB capture.
+ */
+
+class ReportFieldTable
+{
+    public:
+        //! Add the variable input fields of a report descriptor
+        /*!
+         * Constant (padding) and array items only advance the bit position,
+         * values wider than 32 bits are skipped.
+         * \param descriptor    Raw report descriptor
+         * \param length        Number of bytes in descriptor
+         * \return              False if the descriptor is malformed, fields parsed so far are kept
+         */
+        bool parse(const unsigned char *descriptor, size_t length);
+        //! Add a field by hand
+        void add(const ReportField &field) {m_fields.push_back(field);}
+        //! Remove all fields
+        void clear() {m_fields.clear();}
+
+        //! Number of fields
+        size_t size() const {return m_fields.size();}
+        //! Get a field
+        const ReportField &operator[](size_t i) const {return m_fields[i];}
+        //! Find a field by usage
+        /*!
+         * \return              Index of the first matching field, -1 if none
+         */
+        int find(unsigned short usagePage, unsigned short usage) const;
+
+    private:
+        std::vector<ReportField> m_fields;
+};
+
+#endif // REPORTFIELD_H
@@ -0,0 +1,67 @@
+#ifndef REPORTFORMATTER_H
+#define REPORTFORMATTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "reportfield.h"
+
+//! Parts of a formatted report line
+enum ReportFormat
+{
+    //! Bytes as space separated hex
+    FormatHex = 1,
+    //! Bytes as ASCII, non-printable ones as '.'
+    FormatAscii = 2,
+    //! Decoded fields as usagepage:usage=value
+    FormatFields = 4
+};
+
+//! ReportFormatter class
+/*!
+ * Formats reports into caller-provided buffers without allocating, using
+ * lookup tables (and SSE2 for unseparated hex). Buffer sizes are worst cases
+ * given by the *Size() functions.
+ */
+
+class ReportFormatter
+{
+    public:
+        //! Bytes needed by hex()
+        static size_t hexSize(size_t length) {return length * 3;}
+        //! Format bytes as hex
+        /*!
+         * \param report    Report data
+         * \param length    Number of bytes in report
+         * \param out       Buffer of at least hexSize(length) bytes, not terminated
+         * \param separator Character after every byte, 0 for none
+         * \return          Number of characters written
+         */
+        static size_t hex(const unsigned char *report, size_t length, char *out, char separator = ' ');
+        //! Format bytes as ASCII, one character per byte
+        static size_t ascii(const unsigned char *report, size_t length, char *out);
+        //! Format a signed decimal number, at most 20 characters
+        static size_t decimal(int64_t value, char *out);
+
+        //! Bytes needed by line()
+        static size_t lineSize(size_t length, const ReportFieldTable *fields);
+        //! Format a complete log line
+        /*!
+         * "seconds.microseconds vid:pid hex |ascii| fields\n", with the parts
+         * not selected by format left out.
+         * \param time      Time stamp in HidClock nanoseconds
+         * \param vid       Vendor ID
+         * \param pid       Product ID
+         * \param report    Report data
+         * \param length    Number of bytes in report
+         * \param format    ReportFormat flags
+         * \param fields    Fields to decode with FormatFields, may be null
+         * \param out       Buffer of at least lineSize() bytes
+         * \return          Number of characters written, newline included
+         */
+        static size_t line(uint64_t time, unsigned short vid, unsigned short pid,
+                           const unsigned char *report, size_t length, int format,
+                           const ReportFieldTable *fields, char *out);
+};
+
+#endif // REPORTFORMATTER_H
@@ -0,0 +1,107 @@
+#ifndef REPORTLOGGER_H
+#define REPORTLOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "reportfield.h"
+#include "reportformatter.h"
+
+class HidDevice;
+
+//! ReportLogger class
+/*!
+ * Asynchronous text log of reports. log() formats a line straight into one
+ * of a few large preallocated buffers; a background thread writes full
+ * buffers (or whatever is there after the flush interval) to the file in
+ * single large writes. If the disk falls behind and no buffer is free, lines
+ * are dropped and counted instead of stalling the read loop.
+ */
+
+class ReportLogger
+{
+    public:
+        /*!
+         * \param bufferSize    Size of each buffer in bytes
+         * \param buffers       Number of buffers, at least 2
+         */
+        ReportLogger(size_t bufferSize = 1 << 20, unsigned int buffers = 4);
+        //! Writes what is left and closes the file
+        ~ReportLogger();
+
+        //! Open the log file, appending, and start the writer thread
+        /*!
+         * \param path      File name
+         * \return          False if the file could not be opened
+         */
+        bool open(const std::string &path);
+        //! Write what is left, stop the writer thread and close the file
+        void close();
+
+        //! Select the parts of each line, ReportFormat flags (FormatHex | FormatAscii by default)
+        void setFormat(int format) {m_format = format;}
+        //! Set the fields decoded with FormatFields, before open()
+        void setFields(const ReportFieldTable &fields) {m_fields = fields;}
+        //! Set the longest time a line waits in a buffer, in milliseconds (100 by default)
+        void setFlushInterval(unsigned int ms) {m_flushMs = ms;}
+
+        //! Log a report
+        /*!
+         * Safe to call from any number of threads.
+         * \param device    Device the report came from, for its vendor and product ID
+         * \param report    Report data
+         * \param length    Number of bytes in report
+         * \param time      Time stamp in HidClock nanoseconds
+         */
+        void log(HidDevice *device, const unsigned char *report, size_t length, uint64_t time);
+
+        //! Number of lines logged
+        unsigned long long lines() {return m_lines;}
+        //! Number of lines dropped because all buffers were waiting for the disk
+        unsigned long long dropped() {return m_dropped;}
+        //! Number of bytes written to the file
+        unsigned long long written() {return m_written;}
+
+    private:
+        struct Buffer
+        {
+            std::vector<char> data;
+            size_t used = 0;
+        };
+
+        //! Writer thread
+        void run();
+        //! Hand the current buffer to the writer and take a free one, caller holds m_mutex
+        /*!
+         * \return          False if no buffer is free
+         */
+        bool rotate();
+
+        std::mutex m_mutex;
+        std::condition_variable m_full;
+        std::vector<std::unique_ptr<Buffer>> m_free;
+        std::vector<std::unique_ptr<Buffer>> m_pending;
+        std::unique_ptr<Buffer> m_current;
+        size_t m_bufferSize;
+
+        std::FILE *m_file = nullptr;
+        std::thread m_writer;
+        bool m_stop = false;
+
+        int m_format = FormatHex | FormatAscii;
+        ReportFieldTable m_fields;
+        unsigned int m_flushMs = 100;
+
+        std::atomic<unsigned long long> m_lines {0};
+        std::atomic<unsigned long long> m_dropped {0};
+        std::atomic<unsigned long long> m_written {0};
+};
+
+#endif // REPORTLOGGER_H
@@ -0,0 +1,108 @@
+#ifndef REPORTPREDICATE_H
+#define REPORTPREDICATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "reportfield.h"
+
+//! ReportPredicate class
+/*!
+ * Declarative filter on input reports: report IDs, masked byte and bit
+ * comparisons and ranges of decoded fields. Terms added in a row must all
+ * hold, orElse() starts an alternative, so a predicate is an OR of ANDs.
+ *
+ * Every change compiles the terms into a flat program. Byte comparisons of
+ * an alternative are merged into masked compares of up to eight bytes at a
+ * time and run before the field ranges, and an alternative stops at its
+ * first failing instruction, so most reports are rejected after a single
+ * load and compare. Terms on bytes beyond the end of a report do not hold.
+ */
+
+class ReportPredicate
+{
+    public:
+        //! The report ID, the first byte of the report, must equal id
+        ReportPredicate &reportId(unsigned char id) {return byte(0, 0xff, id);}
+        //! The bits of report byte offset selected by mask must equal those of value
+        ReportPredicate &byte(size_t offset, unsigned char mask, unsigned char value);
+        //! The bits of report byte offset selected by mask must differ from those of value
+        ReportPredicate &byteNot(size_t offset, unsigned char mask, unsigned char value);
+        //! A single bit must be set or clear
+        /*!
+         * \param bitOffset     Position of the bit, bits 0 to 7 are the report ID
+         * \param set           true - the bit must be set, false - it must be clear
+         */
+        ReportPredicate &bit(size_t bitOffset, bool set = true)
+            {return byte(bitOffset / 8, (unsigned char)(1 << (bitOffset % 8)), set ? 0xff : 0);}
+        //! The decoded value of a field must lie within [min, max]
+        /*!
+         * Also requires the report ID of the field. Use INT64_MIN or INT64_MAX
+         * for a one-sided threshold.
+         */
+        ReportPredicate &range(const ReportField &field, int64_t min, int64_t max);
+        //! Start an alternative, the predicate holds if any alternative holds
+        ReportPredicate &orElse();
+        //! Remove all terms
+        void clear();
+
+        //! True if no terms were added, an empty predicate matches every report
+        bool empty() const {return m_terms.empty();}
+        //! Number of compiled instructions
+        size_t size() const {return m_program.size();}
+
+        //! Evaluate the predicate
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         */
+        bool matches(const unsigned char *report, size_t length) const;
+
+    private:
+        struct Term
+        {
+            unsigned char op;
+            //! Alternative the term belongs to
+            unsigned int clause;
+            size_t offset;
+            unsigned char mask;
+            unsigned char value;
+            ReportField field;
+            int64_t min;
+            int64_t max;
+        };
+
+        //! One compiled test, 32 bytes
+        struct Instr
+        {
+            unsigned char op;
+            //! Bytes compared, or the field width in bits
+            unsigned char size;
+            bool isSigned;
+            //! Set on the last instruction of an alternative
+            bool last;
+            //! Instruction to continue with on failure, the next alternative
+            uint32_t next;
+            //! Byte offset, or the field's bit offset
+            uint32_t offset;
+            //! Mask, or the field minimum
+            uint64_t a;
+            //! Expected value, or the field maximum
+            uint64_t b;
+        };
+
+        //! Translate the terms into m_program
+        void compile();
+        //! Compile one alternative, returns false if it can never hold
+        bool compileClause(const std::vector<const Term*> &terms, std::vector<Instr> &out) const;
+
+        std::vector<Term> m_terms;
+        //! Alternative new terms are added to
+        unsigned int m_clause = 0;
+        std::vector<Instr> m_program;
+        //! Result if the program is empty: no terms, or an alternative that always holds
+        bool m_matchAll = true;
+};
+
+#endif // REPORTPREDICATE_H
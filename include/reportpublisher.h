@@ -0,0 +1,175 @@
+#ifndef REPORTPUBLISHER_H
+#define REPORTPUBLISHER_H
+
+#include <windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Maximum number of subscribers tracked per shared report ring
+#define MAX_SUBSCRIBERS 32
+
+//! "YRNG", identifies a shared report ring
+#define REPORT_RING_MAGIC 0x474e5259
+#define REPORT_RING_VERSION 1
+
+/*
+ * A shared report ring lives in a named file mapping: a ReportRingHeader
+ * followed by slotCount slots. The publisher is the only writer. Each slot
+ * carries a sequence number that is odd while the slot is being written,
+ * so readers detect torn and overwritten reports without locks. Message n
+ * goes to slot n % slotCount and is complete once the slot sequence is
+ * 2n + 2.
+ */
+
+//! Position of one subscriber, in shared memory
+struct ReportRingSubscriber
+{
+    //! Process ID of the subscriber, 0 if the entry is free
+    std::atomic<uint32_t> pid;
+    //! Index of the next message the subscriber will read
+    std::atomic<uint64_t> position;
+};
+
+//! Header of a shared report ring
+struct ReportRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t slotCount;
+    //! Number of messages published so far
+    std::atomic<uint64_t> writeSeq;
+    ReportRingSubscriber subscribers[MAX_SUBSCRIBERS];
+};
+
+//! Header of a slot, followed by slotSize bytes of report data
+struct ReportRingSlot
+{
+    std::atomic<uint64_t> seq;
+    uint64_t timestamp;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+//! ReportPublisher class
+/*!
+ * Writes reports into a shared memory ring that any number of local
+ * processes can read with ReportSubscriber. Publishing never waits for
+ * subscribers, a subscriber that falls behind by more than the ring size
+ * loses the oldest reports.
+ */
+
+class ReportPublisher
+{
+    public:
+        //! Lag of a subscriber behind the publisher
+        struct Lag
+        {
+            uint32_t pid;
+            uint64_t messages;
+        };
+
+        ReportPublisher() {}
+        //! Unmaps the ring
+        ~ReportPublisher();
+
+        //! Create the named ring
+        /*!
+         * \param name      Mapping name, e.g. L"Local\\yaha-joystick"
+         * \param slotSize  Maximum report length
+         * \param slotCount Number of reports the ring holds
+         * \return          False if the mapping could not be created or the name is in use,
+         *                  also by subscribers of a publisher that is gone
+         */
+        bool create(const std::wstring &name, size_t slotSize, size_t slotCount);
+        //! Append a report to the ring
+        /*!
+         * \param report    Report data
+         * \param length    Number of bytes, truncated to the slot size
+         * \param timestamp Time of reception, HidClock nanoseconds
+         */
+        void publish(const unsigned char *report, size_t length, uint64_t timestamp);
+        //! Number of reports published so far
+        uint64_t published() const;
+        //! Mapping name given to create()
+        const std::wstring &name() const {return m_name;}
+        //! Maximum report length, 0 if not created
+        size_t slotSize() const {return m_header ? m_header->slotSize : 0;}
+        //! Number of reports the ring holds, 0 if not created
+        size_t slotCount() const {return m_header ? m_header->slotCount : 0;}
+        //! Lag of every attached subscriber
+        std::vector<Lag> lags() const;
+
+    private:
+        HANDLE m_mapping = NULL;
+        std::wstring m_name;
+        ReportRingHeader *m_header = nullptr;
+        unsigned char *m_slots = nullptr;
+        size_t m_stride = 0;
+};
+
+//! ReportSubscriber class
+/*!
+ * Reads reports published by a ReportPublisher in another process. Reports
+ * can be copied out with poll() or used in place with peek() and commit().
+ */
+
+class ReportSubscriber
+{
+    public:
+        ReportSubscriber() {}
+        //! Detaches from the ring
+        ~ReportSubscriber();
+
+        //! Attach to a named ring, starting with the next published report
+        /*!
+         * \return          False if the ring does not exist or all subscriber entries are taken
+         */
+        bool open(const std::wstring &name);
+        //! Copy the next report
+        /*!
+         * \param buf       Buffer of at least slotSize() bytes
+         * \param length    Receives the report length
+         * \param timestamp Optionally receives the time of reception
+         * \return          False if no new report is available
+         */
+        bool poll(unsigned char *buf, size_t &length, uint64_t *timestamp = nullptr);
+        //! Get the next report in place, without copying
+        /*!
+         * The data may be overwritten while in use, call commit() when done
+         * to find out if it was.
+         * \return          False if no new report is available
+         */
+        bool peek(const unsigned char *&data, size_t &length, uint64_t *timestamp = nullptr);
+        //! Move past the report returned by peek()
+        /*!
+         * \return          False if the report was overwritten while in use
+         */
+        bool commit();
+
+        //! Maximum report length
+        size_t slotSize() const {return m_header ? m_header->slotSize : 0;}
+        //! Number of published reports not read yet
+        uint64_t lag() const;
+        //! Number of reports overwritten before this subscriber read them
+        uint64_t lost() const {return m_lost;}
+
+    private:
+        //! Find the slot of the next report, skipping lost ones
+        ReportRingSlot *next();
+
+        HANDLE m_mapping = NULL;
+        ReportRingHeader *m_header = nullptr;
+        unsigned char *m_slots = nullptr;
+        size_t m_stride = 0;
+        ReportRingSubscriber *m_entry = nullptr;
+        uint64_t m_position = 0;
+        uint64_t m_lost = 0;
+        //! Sequence of the slot returned by peek()
+        uint64_t m_peekSeq = 0;
+};
+
+#endif // REPORTPUBLISHER_H
@@ -0,0 +1,102 @@
+#ifndef REPORTQUEUE_H
+#define REPORTQUEUE_H
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+//! Policy applied when a report arrives and the queue is full
+enum class OverflowPolicy
+{
+    //! Wait for the consumer to make room (stalls the read loop)
+    Block,
+    //! Discard the oldest queued report to make room
+    DropOldest,
+    //! Discard the arriving report
+    DropNewest,
+    //! Keep only the latest report per report ID, overwriting queued ones in place
+    KeepLatest
+};
+
+//! ReportQueue class
+/*!
+ * Bounded FIFO of input reports between the read loop and the callback
+ * dispatcher. All storage is allocated up front so that pushing a report
+ * never allocates.
+ */
+
+class ReportQueue
+{
+    public:
+        //! Allocates room for depth reports of at most reportLength bytes
+        /*!
+         * \param depth         Maximum number of queued reports
+         * \param reportLength  Maximum length of a single report
+         * \param policy        What to do when the queue is full
+         */
+        ReportQueue(size_t depth, size_t reportLength, OverflowPolicy policy);
+
+        //! Queue a report
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         * \return          False if the report was discarded
+         */
+        bool push(const unsigned char *report, size_t length);
+        //! Take the oldest report, waiting until one is available
+        /*!
+         * \param report    Buffer of at least reportLength bytes
+         * \param length    Receives the number of bytes copied
+         * \return          False if the queue was closed and is empty
+         */
+        bool pop(unsigned char *report, size_t &length);
+        //! Wake up all waiters; pop() drains what is left and then fails
+        void close();
+        //! Change the maximum number of queued reports while the queue is in use
+        /*!
+         * Queued reports are kept, when shrinking the oldest ones beyond the
+         * new depth are dropped. Allocates, but never while push() holds the queue.
+         */
+        void setDepth(size_t depth);
+        //! Change the overflow policy while the queue is in use
+        /*!
+         * A push() blocked on a full queue applies the new policy at once.
+         */
+        void setPolicy(OverflowPolicy policy);
+
+        //! Number of reports discarded or overwritten because the queue was full
+        unsigned long long dropped();
+        //! Number of reports currently queued
+        size_t size();
+
+    private:
+        //! Removes the slot at the head of the queue, caller holds m_mutex
+        void popHead();
+        //! Rebuild m_slotOfId from the queued reports, caller holds m_mutex
+        void indexIds();
+
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+
+        //! Report storage, m_depth slots of m_reportLength bytes
+        std::vector<unsigned char> m_data;
+        //! Length of the report stored in each slot
+        std::vector<size_t> m_lengths;
+        //! Slot currently holding each report ID, -1 if none (KeepLatest only)
+        std::array<int, 256> m_slotOfId;
+
+        size_t m_depth;
+        size_t m_reportLength;
+        OverflowPolicy m_policy;
+        //! Index of the oldest queued report
+        size_t m_head = 0;
+        //! Number of queued reports
+        size_t m_count = 0;
+        unsigned long long m_dropped = 0;
+        bool m_closed = false;
+};
+
+#endif // REPORTQUEUE_H
@@ -0,0 +1,64 @@
+#ifndef REPORTSNAPSHOT_H
+#define REPORTSNAPSHOT_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//! ReportSnapshot class
+/*!
+ * Keeps the most recent input report per report ID. Each report ID has a
+ * slot protected by a sequence lock: the read loop is the only writer and
+ * never waits, readers copy the slot and retry only if it changed under
+ * them, so any number of threads can poll the current state without locks.
+ */
+
+class ReportSnapshot
+{
+    public:
+        //! Prepares empty slots for reports of at most reportLength bytes
+        explicit ReportSnapshot(size_t reportLength);
+        ~ReportSnapshot();
+
+        ReportSnapshot(const ReportSnapshot&) = delete;
+        ReportSnapshot &operator=(const ReportSnapshot&) = delete;
+
+        //! Store a report in the slot of its report ID (first byte)
+        /*!
+         * Must only be called from one thread at a time.
+         * \param report    Report data
+         * \param length    Number of bytes in report
+         */
+        void update(const unsigned char *report, size_t length);
+        //! Copy the latest report with the given report ID
+        /*!
+         * \param id        Report ID, 0 for devices not using report IDs
+         * \param report    Buffer of at least reportLength() bytes
+         * \param length    Receives the number of bytes copied
+         * \param sequence  Optionally receives the number of updates of this slot so far
+         * \return          False if no report with this ID has been received yet
+         */
+        bool read(unsigned char id, unsigned char *report, size_t &length,
+                  unsigned long long *sequence = nullptr) const;
+        //! Maximum report length the slots hold
+        size_t reportLength() const {return m_reportLength;}
+
+    private:
+        struct Slot
+        {
+            //! Odd while the writer is updating the slot
+            std::atomic<unsigned long long> seq;
+            std::atomic<size_t> length;
+            //! Report data packed into words so that it can be accessed atomically
+            std::unique_ptr<std::atomic<uint64_t>[]> words;
+        };
+
+        //! Slots by report ID, allocated by the writer on first use
+        std::array<std::atomic<Slot*>, 256> m_slots;
+        size_t m_reportLength;
+        size_t m_words;
+};
+
+#endif // REPORTSNAPSHOT_H
@@ -0,0 +1,113 @@
+#ifndef ROUNDTRIPPROBE_H
+#define ROUNDTRIPPROBE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "latencyhistogram.h"
+
+class HidDevice;
+
+//! A slow round trip kept for inspection
+struct RoundTripOutlier
+{
+    //! Tag of the probe
+    uint32_t tag;
+    //! Send time in HidClock nanoseconds, to find it in a trace
+    uint64_t sent;
+    //! Write-to-reply latency in nanoseconds
+    uint64_t latency;
+};
+
+//! RoundTripProbe class
+/*!
+ * Measures write-to-reply latency of devices that echo (part of) an output
+ * report back in an input report. Each probe carries a 32-bit tag at a fixed
+ * byte offset; the reply with the same tag completes it. Probes are sent one
+ * at a time, so every sample is a clean round trip without queueing in the
+ * device. Latencies go into a LatencyHistogram, and the slowest round trips
+ * are kept as outliers.
+ */
+
+class RoundTripProbe
+{
+    public:
+        RoundTripProbe();
+
+        //! Set the output report the tag is written into
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report
+         */
+        void setReport(const unsigned char *report, size_t length) {m_report.assign(report, report + length);}
+        //! Set where the little-endian 32-bit tag is in output and input reports
+        /*!
+         * \param output    Byte offset in the output report, 1 by default
+         * \param input     Byte offset in the input report, 1 by default
+         */
+        void setTagOffset(size_t output, size_t input) {m_outputOffset = output; m_inputOffset = input;}
+        //! Set how long to wait for a reply, in milliseconds (1000 by default)
+        void setTimeout(unsigned long ms) {m_timeoutMs = ms;}
+        //! Set the pause between a reply and the next probe, in microseconds (0 by default)
+        void setInterval(unsigned long us) {m_intervalUs = us;}
+        //! Set how many of the slowest round trips are kept (16 by default)
+        void setOutlierCount(size_t n) {m_outlierCount = n;}
+
+        //! Send probes and collect their round-trip times
+        /*!
+         * The device must be open and reading continuously without blocking,
+         * its callbacks are left alone. Results accumulate over several runs
+         * until reset().
+         * \param device    Device to probe
+         * \param count     Number of probes
+         * \return          False if the report does not fit the tag or a write failed
+         */
+        bool run(HidDevice &device, unsigned long count);
+        //! Clear results
+        void reset();
+
+        //! Round-trip latencies in nanoseconds
+        const LatencyHistogram &histogram() const {return m_histogram;}
+        //! Slowest round trips, slowest first
+        std::vector<RoundTripOutlier> outliers();
+        //! Number of probes that got no reply in time
+        unsigned long long timeouts() {return m_timeouts;}
+        //! Number of input reports that did not match the probe in flight, late replies included
+        unsigned long long unmatched();
+
+        //! Match an input report against the probe in flight, called by the read loop
+        /*!
+         * \param report    Report data
+         * \param length    Number of bytes in report
+         * \param time      Arrival time in HidClock nanoseconds
+         */
+        void received(const unsigned char *report, size_t length, uint64_t time);
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_replied;
+        std::vector<unsigned char> m_report;
+        size_t m_outputOffset = 1;
+        size_t m_inputOffset = 1;
+        unsigned long m_timeoutMs = 1000;
+        unsigned long m_intervalUs = 0;
+        size_t m_outlierCount = 16;
+
+        //! Tag of the next probe, never 0
+        uint32_t m_nextTag;
+        //! Tag of the probe in flight, 0 if none
+        uint32_t m_pendingTag = 0;
+        uint64_t m_sent = 0;
+        bool m_matched = false;
+
+        LatencyHistogram m_histogram;
+        //! Min-heap of the slowest round trips
+        std::vector<RoundTripOutlier> m_outliers;
+        unsigned long long m_timeouts = 0;
+        unsigned long long m_unmatched = 0;
+};
+
+#endif // ROUNDTRIPPROBE_H
@@ -0,0 +1,155 @@
+#ifndef SIMULATEDDEVICE_H
+#define SIMULATEDDEVICE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+//! SimulatedDevice class
+/*!
+ * In-process stand-in for a HID device, for CI and load tests without
+ * hardware. A HidDevice constructed from it reads the reports passed to
+ * inject() and hands its output reports to write(), which optionally echoes
+ * them back as input reports. Everything else in the read pipeline (queue,
+ * filters, snapshots, callbacks) runs unchanged.
+ */
+
+class SimulatedDevice
+{
+    public:
+        /*!
+         * \param path                  Device path, e.g. L"sim:echo0", lowercased like system paths
+         * \param inputReportLength     Input report length including the report ID byte
+         * \param outputReportLength    Output report length including the report ID byte
+         */
+        SimulatedDevice(const std::wstring &path, size_t inputReportLength, size_t outputReportLength);
+
+        //! Set vendor ID, product ID and version number
+        void setAttributes(unsigned short vid, unsigned short pid, unsigned short version = 0)
+            {m_vid = vid; m_pid = pid; m_version = version;}
+        //! Set the manufacturer, product and serial number strings
+        void setStrings(const std::wstring &manufacturer, const std::wstring &product, const std::wstring &serialNumber)
+            {m_manufacturer = manufacturer; m_product = product; m_serialNumber = serialNumber;}
+        //! Set the top-level collection usage
+        void setUsage(unsigned short usagePage, unsigned short usage) {m_usagePage = usagePage; m_usage = usage;}
+        //! Set the physical device this collection belongs to
+        /*!
+         * Simulated devices with the same container form one HidDeviceGroup,
+         * like the collections of a composite device. By default every
+         * simulated device is a container of its own.
+         */
+        void setContainer(const std::wstring &container) {m_container = container;}
+        //! Return every output report as an input report
+        /*!
+         * The report is padded with zeros or truncated to the input report length.
+         * \param a         true - echo output reports, false - swallow them (default)
+         * \param delayUs   Time until the echo can be read, in microseconds
+         */
+        void setEcho(bool a, unsigned long delayUs = 0);
+        //! Set how many unread input reports are kept, older ones are dropped like the driver does
+        void setInputBuffers(size_t n);
+
+        //! Queue an input report
+        /*!
+         * \param report    Report data, the first byte being the report ID
+         * \param length    Number of bytes in report, padded or truncated to the input report length
+         * \param delayUs   Time until the report can be read, in microseconds
+         */
+        void inject(const unsigned char *report, size_t length, unsigned long delayUs = 0);
+        //! Take the next due input report
+        /*!
+         * \param buf       Buffer of at least the input report length
+         * \param length    Receives the number of bytes copied
+         * Under a virtual clock the time-out also ends after the same
+         * interval of real time, so a reader notices closing while the
+         * clock stands still.
+         * \param timeout   Time-out interval, in milliseconds
+         * \param due       Receives the HidClock time the report was due, if not null
+         * \return          False if no report became due in time
+         */
+        bool read(unsigned char *buf, size_t &length, unsigned long timeout, uint64_t *due = nullptr);
+        //! Take the next due input report without waiting
+        /*!
+         * \param buf       Buffer of at least the input report length
+         * \param length    Receives the number of bytes copied
+         * \param next      Receives the HidClock time the next queued report is due, UINT64_MAX if none
+         * \param due       Receives the HidClock time the report was due, if not null
+         * \return          False if no report is due yet
+         */
+        bool poll(unsigned char *buf, size_t &length, uint64_t &next, uint64_t *due = nullptr);
+        //! Set a function called whenever a report is queued, e.g. to wake a reader
+        /*!
+         * Called with the device locked, it must not call back into the device.
+         */
+        void setListener(std::function<void()> cb);
+        //! Accept an output report
+        /*!
+         * \return          Always true, a simulated device never fails a write
+         */
+        bool write(const void *report, size_t length);
+
+        const std::wstring &getPath() const {return m_path;}
+        size_t getInputReportLength() const {return m_inputReportLength;}
+        size_t getOutputReportLength() const {return m_outputReportLength;}
+        unsigned short getVid() const {return m_vid;}
+        unsigned short getPid() const {return m_pid;}
+        unsigned short getVersion() const {return m_version;}
+        unsigned short getUsagePage() const {return m_usagePage;}
+        unsigned short getUsage() const {return m_usage;}
+        const std::wstring &getManufacturer() const {return m_manufacturer;}
+        const std::wstring &getProduct() const {return m_product;}
+        const std::wstring &getSerialNumber() const {return m_serialNumber;}
+        //! Container set by setContainer(), the path if none was set
+        const std::wstring &getContainer() const {return m_container.empty() ? m_path : m_container;}
+
+        //! Number of output reports written
+        unsigned long long written();
+        //! Number of input reports dropped because nobody read them
+        unsigned long long dropped();
+
+    private:
+        struct Pending
+        {
+            uint64_t due;
+            unsigned long long seq;
+            std::vector<unsigned char> report;
+            //! Earliest due first, FIFO among equal due times
+            bool operator>(const Pending &o) const {return due != o.due ? due > o.due : seq > o.seq;}
+        };
+
+        //! Queue a report due at the given HidClock time, caller holds m_mutex
+        void push(const unsigned char *report, size_t length, uint64_t due);
+        //! Move the first queued report to buf, caller holds m_mutex
+        void take(unsigned char *buf, size_t &length, uint64_t *due);
+
+        std::mutex m_mutex;
+        std::condition_variable m_inputReady;
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> m_input;
+        size_t m_inputBuffers = 64;
+        unsigned long long m_seq = 0;
+        unsigned long long m_written = 0;
+        unsigned long long m_dropped = 0;
+        bool m_echo = false;
+        std::function<void()> m_listener;
+        uint64_t m_echoDelayNs = 0;
+
+        std::wstring m_path;
+        size_t m_inputReportLength;
+        size_t m_outputReportLength;
+        unsigned short m_vid = 0;
+        unsigned short m_pid = 0;
+        unsigned short m_version = 0;
+        unsigned short m_usagePage = 0;
+        unsigned short m_usage = 0;
+        std::wstring m_manufacturer;
+        std::wstring m_product;
+        std::wstring m_serialNumber;
+        std::wstring m_container;
+};
+
+#endif // SIMULATEDDEVICE_H
@@ -0,0 +1,66 @@
+#ifndef WRITECOALESCER_H
+#define WRITECOALESCER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! WriteCoalescer class
+/*!
+ * Latest-value-wins output queue. Reports are posted under a key and sent
+ * in order of first posting by a separate thread. A report posted while an
+ * older one with the same key is still waiting replaces it, so at most one
+ * report per key is ever pending and the device never executes stale
+ * commands.
+ */
+
+class WriteCoalescer
+{
+    public:
+        //! Starts the sending thread
+        /*!
+         * \param send  Writes one report, blocking until the device accepted it,
+         *              and counts its own failures
+         */
+        explicit WriteCoalescer(std::function<bool(const unsigned char*, size_t)> send);
+        //! Stops the sending thread, pending reports are discarded
+        ~WriteCoalescer();
+
+        //! Queue a report, replacing a pending one with the same key
+        /*!
+         * \param key       Coalescing key, e.g. the report ID
+         * \param report    Report data, copied
+         * \param length    Number of bytes in report
+         */
+        void post(unsigned int key, const unsigned char *report, size_t length);
+
+        //! Number of reports replaced before they were sent
+        unsigned long long coalesced();
+
+    private:
+        struct Pending
+        {
+            std::vector<unsigned char> data;
+            bool queued = false;
+        };
+
+        //! Sending thread
+        void run();
+
+        std::function<bool(const unsigned char*, size_t)> m_send;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        //! Latest report per key, buffers are kept for reuse
+        std::map<unsigned int, Pending> m_pending;
+        //! Keys with a pending report in order of posting
+        std::deque<unsigned int> m_order;
+        unsigned long long m_coalesced = 0;
+        bool m_stopping = false;
+        std::thread m_thread;
+};
+
+#endif // WRITECOALESCER_H
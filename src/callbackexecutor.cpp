@@ -0,0 +1,199 @@
+#include "callbackexecutor.h"
+#include "hiddevice.h"
+
+#include <algorithm>
+
+/* Emptied report buffers kept per shard, more are freed */
+#define EXECUTOR_SPARE_BUFFERS 64
+
+CallbackExecutor::CallbackExecutor(unsigned int shards, bool pin) :
+    m_pin(pin)
+{
+    if (!shards)
+        shards = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned int i = 0; i < shards; i++)
+        m_shards.emplace_back(new Shard());
+    for (unsigned int i = 0; i < shards; i++)
+        m_shards[i]->thread = std::thread([this, i](){this->run(i);});
+}
+
+CallbackExecutor::~CallbackExecutor()
+{
+    m_stop = true;
+    for (auto &s : m_shards) {
+        {
+            std::lock_guard<std::mutex> lock(s->mutex);
+        }
+        s->wake.notify_all();
+    }
+    for (auto &s : m_shards)
+        if (s->thread.joinable())
+            s->thread.join();
+}
+
+unsigned int CallbackExecutor::assign()
+{
+    return m_next++ % shards();
+}
+
+void CallbackExecutor::post(HidDevice *device, unsigned int shard, const unsigned char *report,
+                            size_t length, bool stealable)
+{
+    unsigned int n = shards();
+    shard %= n;
+    Shard &s = *m_shards[shard];
+    bool busy;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::vector<unsigned char> buf;
+        if (!s.spare.empty()) {
+            buf = std::move(s.spare.back());
+            s.spare.pop_back();
+        }
+        buf.assign(report, report + length);
+        s.tasks.push_back(Task{device, std::move(buf), stealable});
+        busy = s.running || s.tasks.size() > 1;
+        if (stealable)
+            m_stealable++;
+    }
+    s.wake.notify_one();
+
+    /* Let the neighbour help out if this shard is behind */
+    if (stealable && busy)
+        wakeNeighbour(shard);
+}
+
+void CallbackExecutor::wakeNeighbour(unsigned int shard)
+{
+    unsigned int n = shards();
+    if (n < 2)
+        return;
+    /* Taking its lock makes sure it either sees m_stealable or is already waiting */
+    Shard &neighbour = *m_shards[(shard + 1) % n];
+    {
+        std::lock_guard<std::mutex> lock(neighbour.mutex);
+    }
+    neighbour.wake.notify_one();
+}
+
+void CallbackExecutor::drain(HidDevice *device)
+{
+    /* Remove everything queued first, so that nothing can be stolen
+     * behind our back while waiting for running callbacks below */
+    for (auto &s : m_shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        auto it = std::remove_if(s->tasks.begin(), s->tasks.end(),
+                                 [device](const Task &t){return t.device == device;});
+        for (auto i = it; i != s->tasks.end(); ++i)
+            if (i->stealable)
+                m_stealable--;
+        s->tasks.erase(it, s->tasks.end());
+    }
+
+    for (auto &s : m_shards) {
+        std::unique_lock<std::mutex> lock(s->mutex);
+        if (s->thread.get_id() == std::this_thread::get_id())
+            continue;
+        s->idle.wait(lock, [&s, device](){return s->running != device;});
+    }
+}
+
+unsigned long long CallbackExecutor::executed(unsigned int shard)
+{
+    Shard &s = *m_shards[shard % shards()];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.executed;
+}
+
+unsigned long long CallbackExecutor::stolen(unsigned int shard)
+{
+    Shard &s = *m_shards[shard % shards()];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.stolen;
+}
+
+size_t CallbackExecutor::pending(unsigned int shard)
+{
+    Shard &s = *m_shards[shard % shards()];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.tasks.size();
+}
+
+void CallbackExecutor::run(unsigned int index)
+{
+    if (m_pin)
+        SetThreadAffinityMask(GetCurrentThread(), ULONG_PTR(1) << (index % (sizeof(ULONG_PTR) * 8)));
+
+    Shard &s = *m_shards[index];
+    while (!m_stop) {
+        Task task;
+        bool have = false;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.tasks.empty()) {
+                task = std::move(s.tasks.front());
+                s.tasks.pop_front();
+                if (task.stealable)
+                    m_stealable--;
+                s.running = task.device;
+                have = true;
+            }
+        }
+        if (have) {
+            execute(index, task, false);
+            continue;
+        }
+        if (m_stealable && steal(index, task)) {
+            /* Still more to take, pass it on around the ring */
+            if (m_stealable)
+                wakeNeighbour(index);
+            execute(index, task, true);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.wake.wait(lock, [this, &s](){return !s.tasks.empty() || m_stealable || m_stop;});
+    }
+}
+
+bool CallbackExecutor::steal(unsigned int thief, Task &task)
+{
+    unsigned int n = shards();
+    Shard &t = *m_shards[thief];
+    for (unsigned int i = 1; i < n; i++) {
+        Shard &v = *m_shards[(thief + i) % n];
+        std::unique_lock<std::mutex> lv(v.mutex, std::defer_lock);
+        std::unique_lock<std::mutex> lt(t.mutex, std::defer_lock);
+        std::lock(lv, lt);
+
+        /* Take from the back, the owner works from the front */
+        for (auto it = v.tasks.rbegin(); it != v.tasks.rend(); ++it) {
+            if (!it->stealable)
+                continue;
+            task = std::move(*it);
+            v.tasks.erase(std::next(it).base());
+            m_stealable--;
+            /* Marked running before the victim is unlocked, see drain() */
+            t.running = task.device;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CallbackExecutor::execute(unsigned int runner, Task &task, bool stolen)
+{
+    task.device->deliverReport(task.report.data(), task.report.size());
+
+    Shard &s = *m_shards[runner];
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.running = nullptr;
+        s.executed++;
+        if (stolen)
+            s.stolen++;
+        if (s.spare.size() < EXECUTOR_SPARE_BUFFERS)
+            s.spare.push_back(std::move(task.report));
+    }
+    s.idle.notify_all();
+}
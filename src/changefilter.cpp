@@ -0,0 +1,78 @@
+#include "changefilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHANGEFILTER_SSE2
+#endif
+
+ChangeFilter::ChangeFilter(size_t reportLength, const std::vector<unsigned char> &ignoreMask) :
+    m_reportLength(reportLength),
+    m_last(256 * reportLength),
+    m_lastLength(256, 0),
+    m_diff(reportLength, 0)
+{
+    setIgnoreMask(ignoreMask);
+}
+
+void ChangeFilter::setIgnoreMask(const std::vector<unsigned char> &ignoreMask)
+{
+    std::shared_ptr<std::vector<unsigned char>> care = std::make_shared<std::vector<unsigned char>>(m_reportLength, 0xff);
+    for (size_t i = 0; i < ignoreMask.size() && i < m_reportLength; i++)
+        (*care)[i] = ~ignoreMask[i];
+    std::atomic_store(&m_care, std::shared_ptr<const std::vector<unsigned char>>(care));
+}
+
+bool ChangeFilter::changed(const unsigned char *report, size_t length)
+{
+    if (length == 0)
+        return false;
+    length = std::min(length, m_reportLength);
+
+    unsigned char id = report[0];
+    unsigned char *last = &m_last[id * m_reportLength];
+
+    bool res;
+    if (m_lastLength[id] != length) {
+        memset(m_diff.data(), 0xff, length);
+        res = true;
+    } else {
+        std::shared_ptr<const std::vector<unsigned char>> care = std::atomic_load(&m_care);
+        res = diff(report, last, care->data(), length);
+    }
+
+    if (res) {
+        memcpy(last, report, length);
+        m_lastLength[id] = length;
+    }
+    return res;
+}
+
+bool ChangeFilter::diff(const unsigned char *a, const unsigned char *b, const unsigned char *care, size_t length)
+{
+    unsigned char *d = m_diff.data();
+    size_t i = 0;
+
+#ifdef CHANGEFILTER_SSE2
+    __m128i any = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)),
+                                  _mm_loadu_si128((const __m128i*)(b + i)));
+        x = _mm_and_si128(x, _mm_loadu_si128((const __m128i*)(care + i)));
+        _mm_storeu_si128((__m128i*)(d + i), x);
+        any = _mm_or_si128(any, x);
+    }
+    bool res = _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff;
+#else
+    bool res = false;
+#endif
+
+    unsigned char tail = 0;
+    for (; i < length; i++) {
+        d[i] = (a[i] ^ b[i]) & care[i];
+        tail |= d[i];
+    }
+    return res || tail != 0;
+}
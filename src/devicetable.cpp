@@ -0,0 +1,246 @@
+#include "devicetable.h"
+
+#define CHUNK_SIZE (1u << DEVICE_TABLE_CHUNK_BITS)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define TABLE_LIMIT (uint32_t(DEVICE_TABLE_CHUNKS) * CHUNK_SIZE)
+//! Initial number of hash slots, a power of two
+#define POOL_SLOTS 64
+
+/* The header documents records as 32 bytes */
+static_assert(sizeof(DeviceInfo) == 32, "DeviceInfo is expected to be 32 bytes");
+
+static inline wchar_t foldChar(wchar_t c)
+{
+    return (c >= L'A' && c <= L'Z') ? wchar_t(c + (L'a' - L'A')) : c;
+}
+
+bool DeviceInfo::operator==(const DeviceInfo &o) const
+{
+    return vid == o.vid && pid == o.pid && version == o.version
+            && usagePage == o.usagePage && usage == o.usage
+            && inputReportLength == o.inputReportLength
+            && outputReportLength == o.outputReportLength
+            && manufacturer == o.manufacturer && product == o.product
+            && serialNumber == o.serialNumber && container == o.container;
+}
+
+StringPool::StringPool(bool fold) :
+    m_fold(fold),
+    m_slots(POOL_SLOTS, INVALID_DEVICE_ID)
+{
+}
+
+uint32_t StringPool::hash(const wchar_t *s, size_t length) const
+{
+    /* FNV-1a over 16 bit units, paths never leave the BMP in practice */
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        wchar_t c = m_fold ? foldChar(s[i]) : s[i];
+        h = (h ^ (uint32_t(c) & 0xffff)) * 16777619u;
+    }
+    return h;
+}
+
+size_t StringPool::slot(const wchar_t *s, size_t length, uint32_t h) const
+{
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        uint32_t index = m_slots[i];
+        if (index == INVALID_DEVICE_ID)
+            return i;
+
+        const Entry &e = m_entries[index];
+        if (e.hash != h || e.length != length)
+            continue;
+        const wchar_t *stored = m_chars.data() + e.offset;
+        size_t k = 0;
+        while (k < length && stored[k] == (m_fold ? foldChar(s[k]) : s[k]))
+            k++;
+        if (k == length)
+            return i;
+    }
+}
+
+uint32_t StringPool::find(const wchar_t *s, size_t length) const
+{
+    return m_slots[slot(s, length, hash(s, length))];
+}
+
+uint32_t StringPool::intern(const wchar_t *s, size_t length)
+{
+    uint32_t h = hash(s, length);
+    size_t i = slot(s, length, h);
+    if (m_slots[i] != INVALID_DEVICE_ID)
+        return m_slots[i];
+
+    Entry e = {uint32_t(m_chars.size()), uint32_t(length), h};
+    for (size_t k = 0; k < length; k++)
+        m_chars.push_back(m_fold ? foldChar(s[k]) : s[k]);
+
+    uint32_t index = uint32_t(m_entries.size());
+    m_entries.push_back(e);
+    m_slots[i] = index;
+    if (m_entries.size() * 2 > m_slots.size())
+        grow();
+    return index;
+}
+
+void StringPool::grow()
+{
+    std::vector<uint32_t> slots(m_slots.size() * 2, INVALID_DEVICE_ID);
+    size_t mask = slots.size() - 1;
+    for (uint32_t index = 0; index < m_entries.size(); index++) {
+        size_t i = m_entries[index].hash & mask;
+        while (slots[i] != INVALID_DEVICE_ID)
+            i = (i + 1) & mask;
+        slots[i] = index;
+    }
+    m_slots.swap(slots);
+}
+
+std::wstring StringPool::get(uint32_t id) const
+{
+    if (id >= m_entries.size())
+        return std::wstring();
+    const Entry &e = m_entries[id];
+    return std::wstring(m_chars.data() + e.offset, e.length);
+}
+
+size_t StringPool::bytes() const
+{
+    return m_chars.capacity() * sizeof(wchar_t) + m_entries.capacity() * sizeof(Entry)
+            + m_slots.capacity() * sizeof(uint32_t);
+}
+
+DeviceTable &DeviceTable::instance()
+{
+    static DeviceTable table;
+    return table;
+}
+
+DeviceTable::DeviceTable() :
+    m_paths(true),
+    m_strings(false)
+{
+    for (size_t i = 0; i < DEVICE_TABLE_CHUNKS; i++) {
+        m_infos[i].store(nullptr, std::memory_order_relaxed);
+        m_current[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    /* Record 0 and string 0 are what devices refer to before they are opened */
+    reserveRecord(0);
+    m_records = 1;
+    m_strings.intern(L"", 0);
+}
+
+DeviceTable::~DeviceTable()
+{
+    for (size_t i = 0; i < DEVICE_TABLE_CHUNKS; i++) {
+        delete[] m_infos[i].load();
+        delete[] m_current[i].load();
+    }
+}
+
+bool DeviceTable::reserveRecord(uint32_t index)
+{
+    if (index >= TABLE_LIMIT)
+        return false;
+    std::atomic<DeviceInfo*> &chunk = m_infos[index >> DEVICE_TABLE_CHUNK_BITS];
+    if (!chunk.load(std::memory_order_relaxed))
+        chunk.store(new DeviceInfo[CHUNK_SIZE], std::memory_order_release);
+    return true;
+}
+
+bool DeviceTable::reserveDevice(DeviceId id)
+{
+    if (id >= TABLE_LIMIT)
+        return false;
+    std::atomic<std::atomic<uint32_t>*> &chunk = m_current[id >> DEVICE_TABLE_CHUNK_BITS];
+    if (!chunk.load(std::memory_order_relaxed)) {
+        std::atomic<uint32_t> *records = new std::atomic<uint32_t>[CHUNK_SIZE];
+        for (size_t i = 0; i < CHUNK_SIZE; i++)
+            records[i].store(0, std::memory_order_relaxed);
+        chunk.store(records, std::memory_order_release);
+    }
+    return true;
+}
+
+DeviceId DeviceTable::intern(const wchar_t *path, size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    DeviceId id = m_paths.find(path, length);
+    if (id != INVALID_DEVICE_ID)
+        return id;
+    if (!reserveDevice(DeviceId(m_paths.size())))
+        return INVALID_DEVICE_ID;
+    return m_paths.intern(path, length);
+}
+
+DeviceId DeviceTable::find(const std::wstring &path) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_paths.find(path.c_str(), path.size());
+}
+
+std::wstring DeviceTable::path(DeviceId id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_paths.get(id);
+}
+
+const DeviceInfo &DeviceTable::info(DeviceId id) const
+{
+    uint32_t record = 0;
+    if (id < TABLE_LIMIT) {
+        std::atomic<uint32_t> *chunk = m_current[id >> DEVICE_TABLE_CHUNK_BITS].load(std::memory_order_acquire);
+        if (chunk)
+            record = chunk[id & CHUNK_MASK].load(std::memory_order_acquire);
+    }
+    return m_infos[record >> DEVICE_TABLE_CHUNK_BITS].load(std::memory_order_acquire)[record & CHUNK_MASK];
+}
+
+void DeviceTable::setInfo(DeviceId id, const DeviceInfo &info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (id >= m_paths.size())
+        return;
+
+    std::atomic<uint32_t> &current = m_current[id >> DEVICE_TABLE_CHUNK_BITS].load()[id & CHUNK_MASK];
+    uint32_t record = current.load(std::memory_order_relaxed);
+    if (m_infos[record >> DEVICE_TABLE_CHUNK_BITS].load()[record & CHUNK_MASK] == info)
+        return;
+
+    /* Readers may still hold the old record, publish a new one instead */
+    if (!reserveRecord(m_records))
+        return;
+    m_infos[m_records >> DEVICE_TABLE_CHUNK_BITS].load()[m_records & CHUNK_MASK] = info;
+    current.store(m_records++, std::memory_order_release);
+}
+
+StringId DeviceTable::internString(const std::wstring &s)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_strings.intern(s.c_str(), s.size());
+}
+
+std::wstring DeviceTable::string(StringId id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_strings.get(id);
+}
+
+size_t DeviceTable::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_paths.size();
+}
+
+size_t DeviceTable::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t chunks = (m_records + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t devices = (m_paths.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    return m_paths.bytes() + m_strings.bytes()
+            + chunks * CHUNK_SIZE * sizeof(DeviceInfo)
+            + devices * CHUNK_SIZE * sizeof(std::atomic<uint32_t>);
+}
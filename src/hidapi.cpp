@@ -1,85 +1,75 @@
 #include "hidapi.h"
-
-#define WND_CLASS_NAME L"HidApi"
-HINSTANCE g_hinst;
+#include "hidtrace.h"
 
 HidApi::HidApi()
 {
-    /* XXX failure handling. */
-    bool res;
-    res = registerWindow();
-    if (res == false) {
-        return;
-    }
-    res = createWindow();
-    if (res == false) {
-        return;
-    }
-
-	GUID InterfaceGuid;
-	HidD_GetHidGuid(&InterfaceGuid);
-
-	DEV_BROADCAST_DEVICEINTERFACE NotificationFilter;
+    m_hotplug.reset(new HotplugPipeline(HOTPLUG_WORKERS,
+            [this](DeviceId id, bool present, bool flapped){hotplugEvent(id, present, flapped);},
+            [this](){hotplugBatchComplete();}));
 
-	ZeroMemory( &NotificationFilter, sizeof(NotificationFilter) );
-	NotificationFilter.dbcc_size = sizeof(DEV_BROADCAST_DEVICEINTERFACE);
-	NotificationFilter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
-	NotificationFilter.dbcc_classguid = InterfaceGuid;
-
-	m_hDeviceNotify = RegisterDeviceNotification(
-	        m_hwnd,
-	        &NotificationFilter,
-	        DEVICE_NOTIFY_ALL_INTERFACE_CLASSES
-	        );
-
-     if (m_hDeviceNotify == NULL)
-         return;
+    /* XXX failure handling. */
+    setHotplugSource(std::unique_ptr<HotplugSource>(new DeviceInterfaceSource()));
 
 	enumerate();
 }
 
 HidApi::~HidApi()
 {
-	for(auto &x : m_devices)
-		delete (x.second);
-	m_devices.clear();
+	if (m_hotplugSource)
+		m_hotplugSource->stop();
+	m_hotplug.reset();
+	/* Groups stop reading before their devices go away. Devices are deleted
+	 * once the last snapshot referring to them is gone. */
+	std::atomic_store(&m_groups, std::make_shared<const HidDeviceGroupMap>());
+	std::atomic_store(&m_devices, std::make_shared<const HidDeviceMap>());
 }
 
-bool HidApi::registerWindow()
+void HidApi::publish(HidDeviceMap &added)
 {
-	WNDCLASS wc;
-	wc.style = 0;
-	wc.cbClsExtra = 0;
-	wc.cbWndExtra = 0;
-	wc.hIcon = NULL;
-	wc.hCursor = NULL;
-	wc.hbrBackground = NULL;
-	wc.lpszMenuName = NULL;
-	wc.lpszClassName = WND_CLASS_NAME;
-	wc.hInstance = g_hinst; // GetModuleHandle(0)
-	wc.lpfnWndProc = HidApi::s_wndProc;
-
-	if(!RegisterClass(&wc))
-		return false;
-	else
-		return true;
+	if (added.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_devicesMutex);
+	std::shared_ptr<HidDeviceMap> next = std::make_shared<HidDeviceMap>(*std::atomic_load(&m_devices));
+	std::shared_ptr<const HidDeviceGroupMap> groups = std::atomic_load(&m_groups);
+	std::shared_ptr<HidDeviceGroupMap> nextGroups;
+
+	for (auto &x : added) {
+		auto inserted = next->insert(x);
+		if (!inserted.second) {
+			/* Registered concurrently, e.g. by enumerate() */
+			x.second = inserted.first->second;
+			continue;
+		}
+
+		StringId container = x.second->getInfo().container;
+		const HidDeviceGroupMap &current = nextGroups ? *nextGroups : *groups;
+		auto it = current.find(container);
+		if (it != current.end()) {
+			it->second->add(x.second.get());
+			continue;
+		}
+		if (!nextGroups)
+			nextGroups = std::make_shared<HidDeviceGroupMap>(*groups);
+		std::shared_ptr<HidDeviceGroup> group = std::make_shared<HidDeviceGroup>(container);
+		group->add(x.second.get());
+		(*nextGroups)[container] = group;
+	}
+
+	std::atomic_store(&m_devices, std::shared_ptr<const HidDeviceMap>(next));
+	if (nextGroups)
+		std::atomic_store(&m_groups, std::shared_ptr<const HidDeviceGroupMap>(nextGroups));
 }
 
-bool HidApi::createWindow()
+bool HidApi::setHotplugSource(std::unique_ptr<HotplugSource> source)
 {
-	m_hwnd = CreateWindow(
-	        WND_CLASS_NAME,
-	        NULL, 0,
-	        CW_USEDEFAULT, 0,
-	        CW_USEDEFAULT, 0,
-	        NULL, NULL,
-	        g_hinst,
-	        this);
-
-	if (m_hwnd == NULL)
+	if (m_hotplugSource)
+		m_hotplugSource->stop();
+	m_hotplugSource = std::move(source);
+	if (!m_hotplugSource)
 		return false;
-	else
-		return true;
+
+	return m_hotplugSource->start([this](const std::wstring &path, bool present){devChanged(path, present);});
 }
 
 bool HidApi::enumerate()
@@ -107,6 +97,9 @@ bool HidApi::enumerate()
 	if(DeviceInfoSet == INVALID_HANDLE_VALUE)
 		return false;
 
+	std::shared_ptr<const HidDeviceMap> current = devices();
+	HidDeviceMap added;
+
 	while (SetupDiEnumDeviceInterfaces(
 	               DeviceInfoSet,
 	               NULL,
@@ -135,137 +128,181 @@ bool HidApi::enumerate()
 		        NULL,
 		        NULL);
 
-		std::wstring path = DeviceInterfaceDetailData->DevicePath;
+		DeviceId id = DeviceTable::instance().intern(DeviceInterfaceDetailData->DevicePath,
+				wcslen(DeviceInterfaceDetailData->DevicePath));
+		free(DeviceInterfaceDetailData);
 
-		HidDevice *CurrentDevice =  new HidDevice(path);
-        if(!CurrentDevice->open()) {
-			delete CurrentDevice;
+		if (id == INVALID_DEVICE_ID || current->count(id))
 			continue;
-		}
 
-		m_devices[CurrentDevice->getPath()] = CurrentDevice;
+		std::shared_ptr<HidDevice> CurrentDevice = std::make_shared<HidDevice>(id);
+        if(!CurrentDevice->open())
+			continue;
 
-		free(DeviceInterfaceDetailData);
+		added[id] = CurrentDevice;
         CurrentDevice->close();
 	}
 
+	publish(added);
+
 	if (DeviceInfoSet)
 		SetupDiDestroyDeviceInfoList(DeviceInfoSet);
 
 	return true;
 }
 
-LRESULT CALLBACK HidApi::s_wndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+void HidApi::devChanged(const std::wstring &path, bool present)
 {
-	HidApi *pThis;
-
-	if (uMsg == WM_NCCREATE) {
-		LPCREATESTRUCT lpcs = reinterpret_cast<LPCREATESTRUCT>(lParam);
-		pThis = static_cast<HidApi*>(lpcs->lpCreateParams);
-		SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(pThis));
-    } else
-		pThis = reinterpret_cast<HidApi*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
-
-    if (pThis)
-        return pThis->wndProc(hwnd, uMsg, wParam, lParam);
-    else
-        return DefWindowProc(hwnd, uMsg, wParam, lParam);
-}
+	/* Notification paths are mixed case, DevicePath in DevInterfaceDetailData
+     * is lower case. The table folds case while hashing, a known path costs
+     * no allocation. */
+    DeviceId id = DeviceTable::instance().intern(path);
+    if (id == INVALID_DEVICE_ID)
+        return;
 
-LRESULT HidApi::wndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
-{
-	if (uMsg == WM_DEVICECHANGE && lParam != 0) {
-		DEV_BROADCAST_DEVICEINTERFACE *const d = (DEV_BROADCAST_DEVICEINTERFACE*)lParam;
-		switch(wParam) {
-		case DBT_DEVICEARRIVAL:
-			devAdded(*d);
-			break;
-		case DBT_DEVICEREMOVECOMPLETE:
-			devRemoved(*d);
-			break;
-		}
-		return true;
-	} else
-		return DefWindowProc(hwnd, uMsg, wParam, lParam);
+    /* Opening the device queries descriptors and strings, which may take
+     * long. Leave it to the hotplug workers. */
+    m_hotplug->post(id, present);
 }
 
-void HidApi::devAdded(DEV_BROADCAST_DEVICEINTERFACE &d)
+void HidApi::hotplugEvent(DeviceId id, bool present, bool flapped)
 {
-	GUID InterfaceGuid;
-	HidD_GetHidGuid(&InterfaceGuid);
-
-	if(d.dbcc_classguid != InterfaceGuid)
-		return;
-
-	/* dbcc_name is mixed case, DevicePath in DevInterfaceDetailData
-     * is lower case */
-    std::wstring path = d.dbcc_name;
-    std::transform (path.begin(), path.end(), path.begin(), tolower);
-
-    /* If an object for this device already exists, set its state to connected,
-     * otherwise create new object and add to container. */
-    if (m_devices[path] != nullptr) {
-        m_devices[path]->connected();
-        if(m_callbackArrival)
-            m_callbackArrival(m_devices[path]);
-    } else {
-        HidDevice *Device = new HidDevice(path);
-        if(!Device->open()) {
-            delete Device;
+    HidTraceScope trace(present ? "arrival" : "removal", "hotplug", this);
+    std::shared_ptr<const HidDeviceMap> current = devices();
+    auto it = current->find(id);
+
+    if (present) {
+        /* If an object for this device already exists, set its state to connected,
+         * otherwise create new object and add to the registry. */
+        std::shared_ptr<HidDevice> Device;
+        if (it != current->end()) {
+            Device = it->second;
+            if (Device->isConnected()) {
+                if (!flapped)
+                    return;
+                /* Removed and added again within the debounce interval,
+                 * handles opened before are no longer valid. */
+                Device->removed();
+            }
+            Device->connected();
         } else {
-            m_devices[path] = Device;
+            std::shared_ptr<SimulatedDevice> sim;
+            {
+                std::lock_guard<std::mutex> lock(m_simulatedMutex);
+                auto s = m_simulated.find(id);
+                if (s != m_simulated.end())
+                    sim = s->second;
+            }
+            Device = sim ? std::make_shared<HidDevice>(sim) : std::make_shared<HidDevice>(id);
+            if(!Device->open())
+                return;
             Device->close();
+
+            HidDeviceMap added;
+            added[id] = Device;
+            publish(added);
+            /* Report the object in the registry, ours is dropped if another one won */
+            Device = added[id];
         }
 
-        if(m_callbackArrival)
-            m_callbackArrival(Device);
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        m_arrivals.push_back(Device.get());
+    } else {
+        if (it == current->end() || !it->second->isConnected())
+            return;
+
+        it->second->removed();
+
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        m_removals.push_back(it->second.get());
     }
-    return;
 }
 
-void HidApi::devRemoved(DEV_BROADCAST_DEVICEINTERFACE &d)
+void HidApi::hotplugBatchComplete()
 {
-	GUID InterfaceGuid;
-	HidD_GetHidGuid(&InterfaceGuid);
-
-	if(d.dbcc_classguid != InterfaceGuid)
-		return;
+    HidTraceScope trace("hotplug callbacks", "hotplug", this);
+	std::vector<HidDevice*> arrivals, removals;
+	{
+		std::lock_guard<std::mutex> lock(m_batchMutex);
+		arrivals.swap(m_arrivals);
+		removals.swap(m_removals);
+	}
 
-	std::wstring path = d.dbcc_name;
-	std::transform (path.begin(), path.end(), path.begin(), tolower);
+	for (HidDevice *Device : removals) {
+		std::function<void(HidDevice*)> cb = Device->getCallbackRemoval();
+		if(cb != nullptr)
+			cb(Device);
 
-	HidDevice *Device = m_devices[path];
-	if(!Device)
-		return;
+		if(m_callbackRemoval)
+			m_callbackRemoval(Device);
+	}
 
-    Device->removed();
+	for (HidDevice *Device : arrivals)
+		if(m_callbackArrival)
+			m_callbackArrival(Device);
 
-	std::function<void(HidDevice*)> cb = Device->getCallbackRemoval();
-	if(cb != nullptr)
-        cb(Device);
+	if(!arrivals.empty() && m_callbackArrivalBatch)
+		m_callbackArrivalBatch(arrivals);
+}
 
-	if(m_callbackRemoval)
-		m_callbackRemoval(Device);
+void HidApi::addSimulatedDevice(std::shared_ptr<SimulatedDevice> sim)
+{
+	if (!sim)
+		return;
+	DeviceId id = DeviceTable::instance().intern(sim->getPath());
+	if (id == INVALID_DEVICE_ID)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_simulatedMutex);
+		m_simulated[id] = sim;
+	}
+	m_hotplug->post(id, true);
+}
 
-	return;
+void HidApi::removeSimulatedDevice(const std::wstring &path)
+{
+	DeviceId id = DeviceTable::instance().find(path);
+	if (id != INVALID_DEVICE_ID)
+		m_hotplug->post(id, false);
 }
 
 HidDevice* HidApi::getHidDevice(unsigned short vid, unsigned short pid)
 {
-	for (auto &x : m_devices) {
+	std::shared_ptr<const HidDeviceMap> current = devices();
+	for (auto &x : *current) {
 		if ((x.second)->getVid() == vid && (x.second)->getPid() == pid)
-			return x.second;
+			return x.second.get();
 	}
 
     return nullptr;
 }
 
+HidDeviceGroup* HidApi::getHidDeviceGroup(HidDevice *device)
+{
+	if (!device)
+		return nullptr;
+	std::shared_ptr<const HidDeviceGroupMap> current = groups();
+	auto it = current->find(device->getInfo().container);
+	if (it == current->end())
+		return nullptr;
+
+	std::vector<HidDevice*> members = it->second->getDevices();
+	if (std::find(members.begin(), members.end(), device) == members.end())
+		return nullptr;
+	return it->second.get();
+}
+
 HidDevice* HidApi::getHidDevice(std::wstring path)
 {
-	for (auto &x : m_devices) {
-		if ((x.second)->getPath() == path)
-			return x.second;
-	}
+	return getHidDevice(DeviceTable::instance().find(path));
+}
+
+HidDevice* HidApi::getHidDevice(DeviceId id)
+{
+	std::shared_ptr<const HidDeviceMap> current = devices();
+	auto it = current->find(id);
+	if (it != current->end())
+		return it->second.get();
 
     return nullptr;
 }
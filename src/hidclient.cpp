@@ -0,0 +1,328 @@
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "hidclient.h"
+
+#include <algorithm>
+
+bool RemoteDevice::open()
+{
+    std::vector<unsigned char> frame;
+    HidFrameWriter w(frame);
+    w.begin(HID_MSG_OPEN);
+    w.put32(m_info.id);
+    w.end();
+
+    std::unique_lock<std::mutex> lock(m_client->m_mutex);
+    if (m_open)
+        return true;
+    m_openResult = -1;
+    lock.unlock();
+
+    if (!m_client->send(frame))
+        return false;
+
+    lock.lock();
+    m_client->m_cv.wait(lock, [this](){return m_openResult >= 0 || !m_client->m_connected;});
+    if (m_openResult != 1)
+        return false;
+
+    std::lock_guard<std::mutex> deviceLock(m_mutex);
+    m_buf.assign(m_info.inputReportLength, 0);
+    m_readBuf = m_buf.data();
+    m_pending.clear();
+    m_open = true;
+    return true;
+}
+
+bool RemoteDevice::close()
+{
+    std::vector<unsigned char> frame;
+    HidFrameWriter w(frame);
+    w.begin(HID_MSG_CLOSE);
+    w.put32(m_info.id);
+    w.end();
+
+    {
+        std::lock_guard<std::mutex> lock(m_client->m_mutex);
+        if (!m_open)
+            return false;
+        m_open = false;
+    }
+    m_cv.notify_all();
+    return m_client->send(frame);
+}
+
+void RemoteDevice::setCallbackReadComplete(std::function<void(RemoteDevice*)> cb)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_callbackReadComplete = cb;
+}
+
+bool RemoteDevice::read()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this](){return !m_pending.empty() || !m_open || !m_info.connected;});
+    if (m_pending.empty())
+        return false;
+
+    std::vector<unsigned char> &r = m_pending.front();
+    memcpy(m_buf.data(), r.data(), std::min(r.size(), m_buf.size()));
+    m_pending.pop_front();
+    return true;
+}
+
+bool RemoteDevice::write(const void *b)
+{
+    return writeBatch(b, 1);
+}
+
+bool RemoteDevice::writeBatch(const void *reports, size_t count)
+{
+    if (reports == nullptr || !m_open)
+        return false;
+
+    const unsigned char *r = (const unsigned char*)reports;
+    size_t length = m_info.outputReportLength;
+    std::vector<unsigned char> frame;
+    HidFrameWriter w(frame);
+
+    w.begin(HID_MSG_WRITE);
+    for (size_t i = 0; i < count; i++) {
+        if (w.count() == UINT16_MAX || w.size() + length > HID_FRAME_MAX) {
+            w.end();
+            w.begin(HID_MSG_WRITE);
+        }
+        w.putReport(m_info.id, r + i * length, length);
+    }
+    w.end();
+    return m_client->send(frame);
+}
+
+void RemoteDevice::received(const unsigned char *report, size_t length)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_open)
+        return;
+
+    if (m_callbackReadComplete) {
+        memcpy(m_buf.data(), report, std::min(length, m_buf.size()));
+        std::function<void(RemoteDevice*)> cb = m_callbackReadComplete;
+        lock.unlock();
+        cb(this);
+        return;
+    }
+
+    if (m_pending.size() == REMOTE_READ_QUEUE)
+        m_pending.pop_front();
+    m_pending.push_back(std::vector<unsigned char>(report, report + length));
+    lock.unlock();
+    m_cv.notify_one();
+}
+
+void RemoteDevice::lost()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_info.connected = false;
+    }
+    m_cv.notify_all();
+}
+
+HidClient::HidClient() :
+    m_socket((uintptr_t)INVALID_SOCKET)
+{
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+}
+
+HidClient::~HidClient()
+{
+    disconnect();
+    WSACleanup();
+}
+
+bool HidClient::connect(const std::string &socketPath)
+{
+    if (m_connected)
+        return false;
+
+    sockaddr_un addr;
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return false;
+    if (::connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return false;
+    }
+
+    m_socket = (uintptr_t)s;
+    m_connected = true;
+    m_receiver = std::thread([this](){this->receiverThread();});
+    return enumerate();
+}
+
+void HidClient::disconnect()
+{
+    if (m_socket == (uintptr_t)INVALID_SOCKET)
+        return;
+
+    shutdown((SOCKET)m_socket, SD_BOTH);
+    if (m_receiver.joinable())
+        m_receiver.join();
+    closesocket((SOCKET)m_socket);
+    m_socket = (uintptr_t)INVALID_SOCKET;
+}
+
+bool HidClient::enumerate()
+{
+    std::vector<unsigned char> frame;
+    HidFrameWriter w(frame);
+    w.begin(HID_MSG_ENUMERATE);
+    w.end();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    unsigned long before = m_enumerations;
+    lock.unlock();
+
+    if (!send(frame))
+        return false;
+
+    lock.lock();
+    m_cv.wait(lock, [this, before](){return m_enumerations != before || !m_connected;});
+    return m_enumerations != before;
+}
+
+std::vector<RemoteDevice*> HidClient::devices()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<RemoteDevice*> res;
+    for (auto &x : m_devices)
+        res.push_back(x.second.get());
+    return res;
+}
+
+RemoteDevice *HidClient::getDevice(unsigned short vid, unsigned short pid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &x : m_devices)
+        if (x.second->getVid() == vid && x.second->getPid() == pid)
+            return x.second.get();
+    return nullptr;
+}
+
+bool HidClient::send(const std::vector<unsigned char> &frame)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_connected && hidSendAll(m_socket, frame.data(), frame.size());
+}
+
+RemoteDevice *HidClient::update(const HidDeviceInfo &info)
+{
+    std::unique_ptr<RemoteDevice> &d = m_devices[info.id];
+    if (!d)
+        d.reset(new RemoteDevice(this));
+
+    std::lock_guard<std::mutex> lock(d->m_mutex);
+    d->m_info = info;
+    return d.get();
+}
+
+void HidClient::receiverThread()
+{
+    HidFrameHeader h;
+    std::vector<unsigned char> payload;
+
+    while (hidRecvFrame(m_socket, h, payload)) {
+        HidFrameReader r(payload.data(), payload.size());
+
+        switch (h.type) {
+        case HID_MSG_REPORTS: {
+            uint32_t id;
+            const unsigned char *report;
+            size_t length;
+            for (uint16_t i = 0; i < h.count && r.getReport(id, report, length); i++) {
+                RemoteDevice *d;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto it = m_devices.find(id);
+                    if (it == m_devices.end())
+                        continue;
+                    d = it->second.get();
+                }
+                d->received(report, length);
+            }
+            break;
+        }
+        case HID_MSG_DEVICES: {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            HidDeviceInfo info;
+            for (uint16_t i = 0; i < h.count && r.getDeviceInfo(info); i++)
+                update(info);
+            m_enumerations++;
+            m_cv.notify_all();
+            break;
+        }
+        case HID_MSG_OPENED: {
+            uint32_t id;
+            uint8_t res;
+            if (!r.get32(id) || !r.get8(res))
+                break;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_devices.find(id);
+            if (it != m_devices.end())
+                it->second->m_openResult = res ? 1 : 0;
+            m_cv.notify_all();
+            break;
+        }
+        case HID_MSG_ARRIVAL: {
+            HidDeviceInfo info;
+            if (!r.getDeviceInfo(info))
+                break;
+            RemoteDevice *d;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                d = update(info);
+            }
+            if (m_callbackArrival)
+                m_callbackArrival(d);
+            break;
+        }
+        case HID_MSG_REMOVAL: {
+            uint32_t id;
+            if (!r.get32(id))
+                break;
+            RemoteDevice *d;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_devices.find(id);
+                if (it == m_devices.end())
+                    break;
+                d = it->second.get();
+            }
+            d->lost();
+            if (d->m_callbackRemoval)
+                d->m_callbackRemoval(d);
+            if (m_callbackRemoval)
+                m_callbackRemoval(d);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected = false;
+        for (auto &x : m_devices)
+            x.second->lost();
+    }
+    m_cv.notify_all();
+}
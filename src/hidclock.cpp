@@ -0,0 +1,54 @@
+#include "hidclock.h"
+
+std::atomic<VirtualClock*> HidClock::s_virtual {nullptr};
+
+HidClock::Listener::Listener(std::function<void()> cb) :
+    m_clock(HidClock::getVirtual())
+{
+    if (m_clock)
+        m_id = m_clock->subscribe(cb);
+}
+
+HidClock::Listener::~Listener()
+{
+    if (m_clock)
+        m_clock->unsubscribe(m_id);
+}
+
+VirtualClock::VirtualClock(uint64_t start) :
+    m_now(start)
+{
+}
+
+void VirtualClock::advance(uint64_t ns)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_now.fetch_add(ns, std::memory_order_acq_rel);
+    for (auto &l : m_listeners)
+        l.second();
+}
+
+void VirtualClock::advanceTo(uint64_t time)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (time <= m_now.load(std::memory_order_relaxed))
+        return;
+    m_now.store(time, std::memory_order_release);
+    for (auto &l : m_listeners)
+        l.second();
+}
+
+int VirtualClock::subscribe(std::function<void()> cb)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int id = m_nextId++;
+    m_listeners[id] = cb;
+    return id;
+}
+
+void VirtualClock::unsubscribe(int id)
+{
+    /* Taking the lock waits for a listener call in progress */
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listeners.erase(id);
+}
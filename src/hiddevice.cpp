@@ -1,4 +1,48 @@
 #include "hiddevice.h"
+#include "hidclock.h"
+#include "hiddevicegroup.h"
+#include "hidtrace.h"
+
+#include <initguid.h>
+#include <devpkey.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+
+/* Collections of one physical device share its container ID, except for
+ * devices built into the computer, which all carry the null container.
+ * Collections of one interface also share their parent device node. */
+static std::wstring containerOf(const std::wstring &path)
+{
+    static const GUID nullContainer = {0x00000000, 0x0000, 0x0000, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+    wchar_t instance[MAX_DEVICE_ID_LEN];
+    ULONG size = sizeof(instance);
+    DEVPROPTYPE type;
+    DEVINST node, parent;
+
+    if (CM_Get_Device_Interface_PropertyW(path.c_str(), &DEVPKEY_Device_InstanceId, &type,
+                                          (PBYTE)instance, &size, 0) != CR_SUCCESS
+            || CM_Locate_DevNodeW(&node, instance, CM_LOCATE_DEVNODE_NORMAL) != CR_SUCCESS)
+        return path;
+
+    GUID container;
+    size = sizeof(container);
+    if (CM_Get_DevNode_PropertyW(node, &DEVPKEY_Device_ContainerId, &type, (PBYTE)&container, &size, 0) == CR_SUCCESS
+            && container != nullContainer) {
+        wchar_t s[40];
+        swprintf(s, 40, L"{%08lX-%04hX-%04hX-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+                 container.Data1, container.Data2, container.Data3,
+                 container.Data4[0], container.Data4[1], container.Data4[2], container.Data4[3],
+                 container.Data4[4], container.Data4[5], container.Data4[6], container.Data4[7]);
+        return s;
+    }
+
+    if (CM_Get_Parent(&parent, node, 0) == CR_SUCCESS
+            && CM_Get_Device_IDW(parent, instance, MAX_DEVICE_ID_LEN, 0) == CR_SUCCESS)
+        return instance;
+    return path;
+}
 
 HidDevice::HidDevice()
 {
@@ -6,29 +50,62 @@ HidDevice::HidDevice()
     m_overlapped.InternalHigh = 0;
     m_overlapped.Pointer = 0;
     m_overlapped.hEvent = 0;
-    m_attributes.Size = sizeof(HIDD_ATTRIBUTES);
+    ZeroMemory(&m_submitOverlapped, sizeof(m_submitOverlapped));
 }
 
-HidDevice::HidDevice(std::wstring path)
+HidDevice::HidDevice(std::wstring path) :
+    HidDevice(DeviceTable::instance().intern(path))
+{
+}
+
+HidDevice::HidDevice(DeviceId id) :
+    m_id(id)
 {
     m_overlapped.Internal = 0;
     m_overlapped.InternalHigh = 0;
     m_overlapped.Pointer = 0;
     m_overlapped.hEvent = 0;
-    m_attributes.Size = sizeof(HIDD_ATTRIBUTES);
-    m_path = path;
+    ZeroMemory(&m_submitOverlapped, sizeof(m_submitOverlapped));
+}
+
+HidDevice::HidDevice(std::shared_ptr<SimulatedDevice> sim) :
+    m_sim(sim),
+    m_id(DeviceTable::instance().intern(sim->getPath()))
+{
+    m_overlapped.Internal = 0;
+    m_overlapped.InternalHigh = 0;
+    m_overlapped.Pointer = 0;
+    m_overlapped.hEvent = 0;
+    ZeroMemory(&m_submitOverlapped, sizeof(m_submitOverlapped));
 }
 
 HidDevice::~HidDevice()
 {
+    HidDeviceGroup *group = m_group;
+    if(group)
+        group->detach(this);
     m_connected = false;
+    m_coalescer.reset();
+    if(m_queue)
+        m_queue->close();
     if(m_readThread.joinable())
         m_readThread.join();
+    if(m_dispatchThread.joinable())
+        m_dispatchThread.join();
     if(m_writeThread.joinable())
         m_writeThread.join();
+    if(m_executor)
+        m_executor->drain(this);
+    if(isOpen()) {
+        std::unique_lock<std::mutex> lock(m_submitMutex);
+        m_batchDone.wait(lock, [this](){return !m_batchActive;});
+        finishSubmitted(true);
+    }
     if(m_overlapped.hEvent)
         CloseHandle(m_overlapped.hEvent);
-    if(isOpen())
+    if(m_submitOverlapped.hEvent)
+        CloseHandle(m_submitOverlapped.hEvent);
+    if(m_handle != INVALID_HANDLE_VALUE)
         CloseHandle(m_handle);
     if(m_readBuf != nullptr) {
         delete(m_readBuf);
@@ -36,12 +113,9 @@ HidDevice::~HidDevice()
     }
 }
 
-bool HidDevice::open()
+bool HidDevice::openHandle()
 {
-    HIDP_CAPS caps;
-    PHIDP_PREPARSED_DATA pp_data = NULL;
     BOOL res;
-    NTSTATUS nt_res;
     DWORD DesiredAccess = GENERIC_WRITE | GENERIC_READ;
     DWORD SharedMode = FILE_SHARE_READ | FILE_SHARE_WRITE;
 
@@ -55,8 +129,9 @@ bool HidDevice::open()
     InitializeSecurityDescriptor(&sd, SECURITY_DESCRIPTOR_REVISION);
     SetSecurityDescriptorDacl(&sd, TRUE, NULL, FALSE);
 
+    std::wstring path = DeviceTable::instance().path(m_id);
     m_handle = CreateFileW(
-                m_path.c_str(),
+                path.c_str(),
                 DesiredAccess,
                 SharedMode,
                 &sa,
@@ -76,11 +151,35 @@ bool HidDevice::open()
     if (m_overlapped.hEvent == NULL)
         return false;
 
+    m_submitOverlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (m_submitOverlapped.hEvent == NULL)
+        return false;
+
     /* Set the maximum number of input reports that the HID class driver ring buffer can hold for a specified top-level collection. */
-    res = HidD_SetNumInputBuffers(m_handle, 64);
+    res = HidD_SetNumInputBuffers(m_handle, m_numInputBuffers);
     if (!res)
         return false;
 
+    return true;
+}
+
+bool HidDevice::open()
+{
+    HidTraceScope trace("open", "device", this);
+    if (m_sim)
+        return openSimulated();
+
+    HIDP_CAPS caps;
+    HIDD_ATTRIBUTES attributes;
+    DeviceInfo info;
+    DeviceTable &table = DeviceTable::instance();
+    PHIDP_PREPARSED_DATA pp_data = NULL;
+    BOOL res;
+    NTSTATUS nt_res;
+
+    if (!openHandle())
+        return false;
+
     /* Preparsed data is report descriptor data associated with a top-level collection. User-mode applications or kernel-mode drivers
      * use preparsed data to extract information about specific HID controls without having to obtain and interpret a device's entire
      * report descriptor. */
@@ -95,22 +194,25 @@ bool HidDevice::open()
 
     m_outputReportLength = caps.OutputReportByteLength;
     m_inputReportLength = caps.InputReportByteLength;
-    m_usagePage = caps.UsagePage;
-    m_usage = caps.Usage;
+    info.inputReportLength = caps.InputReportByteLength;
+    info.outputReportLength = caps.OutputReportByteLength;
+    info.usagePage = caps.UsagePage;
+    info.usage = caps.Usage;
     /* Release the resources that the HID class driver allocated to hold a top-level collection's preparsed data. */
     res = HidD_FreePreparsedData(pp_data);
     if (!res)
         return false;
 
-    if(m_readBuf != nullptr)
-        delete m_readBuf;
-    m_readBuf = new unsigned char[m_inputReportLength];
-    if(m_readBuf == nullptr)
+    if(!allocReadBuf())
         return false;
 
-    HidD_GetAttributes(m_handle, &m_attributes);
+    attributes.Size = sizeof(HIDD_ATTRIBUTES);
+    HidD_GetAttributes(m_handle, &attributes);
 
-    if (m_attributes.VendorID != 0x00 && m_attributes.ProductID != 0x00) {
+    if (attributes.VendorID != 0x00 && attributes.ProductID != 0x00) {
+        info.vid = attributes.VendorID;
+        info.pid = attributes.ProductID;
+        info.version = attributes.VersionNumber;
 
 #define WSTR_LEN 512
         wchar_t wstr[WSTR_LEN]; /* XXX Determine Size */
@@ -118,31 +220,118 @@ bool HidDevice::open()
         res = HidD_GetSerialNumberString(m_handle, wstr, sizeof(wstr));
         wstr[WSTR_LEN-1] = 0x0000;
         if (res)
-            m_serialNumber = wstr;
+            info.serialNumber = table.internString(wstr);
 
         res = HidD_GetManufacturerString(m_handle, wstr, sizeof(wstr));
         wstr[WSTR_LEN-1] = 0x0000;
         if (res)
-            m_manufacturer = wstr;
+            info.manufacturer = table.internString(wstr);
 
         res = HidD_GetProductString(m_handle, wstr, sizeof(wstr));
         wstr[WSTR_LEN-1] = 0x0000;
         if (res)
-            m_product = wstr;
+            info.product = table.internString(wstr);
 
+        info.container = table.internString(containerOf(table.path(m_id)));
+        table.setInfo(m_id, info);
+        m_descriptorCached = true;
         return true;
     } else
         return false;
 }
 
+bool HidDevice::reopen()
+{
+    HidTraceScope trace("reopen", "device", this);
+    if (!m_descriptorCached || m_sim)
+        return open();
+
+    /* Report lengths, attributes and strings do not change while the device
+     * is unplugged, only a new handle is needed. */
+    if (!openHandle())
+        return false;
+    return allocReadBuf();
+}
+
+bool HidDevice::openSimulated()
+{
+    m_inputReportLength = m_sim->getInputReportLength();
+    m_outputReportLength = m_sim->getOutputReportLength();
+
+    DeviceTable &table = DeviceTable::instance();
+    DeviceInfo info;
+    info.vid = m_sim->getVid();
+    info.pid = m_sim->getPid();
+    info.version = m_sim->getVersion();
+    info.usagePage = m_sim->getUsagePage();
+    info.usage = m_sim->getUsage();
+    info.inputReportLength = (unsigned short)m_inputReportLength;
+    info.outputReportLength = (unsigned short)m_outputReportLength;
+    info.manufacturer = table.internString(m_sim->getManufacturer());
+    info.product = table.internString(m_sim->getProduct());
+    info.serialNumber = table.internString(m_sim->getSerialNumber());
+    info.container = table.internString(m_sim->getContainer());
+    table.setInfo(m_id, info);
+    m_descriptorCached = true;
+
+    if (!allocReadBuf())
+        return false;
+    m_simOpen = true;
+    return true;
+}
+
+bool HidDevice::allocReadBuf()
+{
+    if(m_readBuf != nullptr)
+        delete m_readBuf;
+    m_readBuf = new unsigned char[m_inputReportLength];
+    return m_readBuf != nullptr;
+}
+
 bool HidDevice::close()
 {
+    HidTraceScope trace("close", "device", this);
     m_closing = true;
+    /* Takes the device off the reactor before the handle goes away */
+    HidDeviceGroup *group = m_group;
+    if(group)
+        group->detach(this);
+    /* Wakes up a read loop blocked on a full queue */
+    if(m_queue)
+        m_queue->close();
     if(m_readThread.joinable())
         m_readThread.join();
+    if(m_dispatchThread.joinable())
+        m_dispatchThread.join();
     if(m_writeThread.joinable())
         m_writeThread.join();
+    if(m_executor)
+        m_executor->drain(this);
     m_closing = false;
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_streaming = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_coalescerMutex);
+        m_coalescer.reset();
+    }
+
+    if(m_sim) {
+        m_simOpen = false;
+        delete(m_readBuf);
+        m_readBuf = nullptr;
+        return true;
+    }
+    {
+        /* A batch writes without the lock, let it finish before the handle goes */
+        std::unique_lock<std::mutex> lock(m_submitMutex);
+        m_batchDone.wait(lock, [this](){return !m_batchActive;});
+        finishSubmitted(true);
+        CloseHandle(m_submitOverlapped.hEvent);
+        m_submitOverlapped.hEvent = 0;
+    }
 
     BOOL res;
     CloseHandle(m_overlapped.hEvent); /* XXX is this correct? */
@@ -163,25 +352,71 @@ void HidDevice::removed()
 {
     m_connected = false;
 
+    /* Remember what to resume when the device comes back */
+    m_resumeOpen = isOpen();
+    m_resumeRead = m_resumeOpen && !m_readBlocking && m_readContinuous && (m_readThread.joinable() || m_attached);
+
     if(isOpen())
         close();
 }
 
+void HidDevice::connected()
+{
+    m_connected = true;
+    if(!m_autoReconnect || !m_resumeOpen || isOpen())
+        return;
+    m_resumeOpen = false;
+
+    m_reconnectStart = HidClock::now();
+    if(!reopen()) {
+        m_reconnectStart = 0;
+        return;
+    }
+    m_reconnects++;
+    if(m_resumeRead)
+        read();
+}
+
 void HidDevice::readThread()
 {
+    /* While queueing, m_readBuf belongs to the dispatch thread or executor */
+    unsigned char *buf = (m_queue || m_executor) ? m_ioBuf.data() : m_readBuf;
+
+    if(m_readCpu >= 0)
+        SetThreadAffinityMask(GetCurrentThread(), ULONG_PTR(1) << m_readCpu);
+    m_spinNs = m_spinBudgetNs;
+
+    if(m_sim) {
+        simulatedReadLoop(buf);
+        if(m_queue)
+            m_queue->close();
+        return;
+    }
+
     do {
-        DWORD res;
-        ReadFileEx(m_handle, m_readBuf, m_inputReportLength, &m_overlapped,
+        DWORD res = WAIT_TIMEOUT;
+        ReadFileEx(m_handle, buf, m_inputReportLength, &m_overlapped,
                    fileReadIOComplete);
+        uint64_t issued = HidClock::now();
 
-        do {
+        if(m_spinNs && spinRead()) {
+            res = WAIT_IO_COMPLETION;
+            m_spinHits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_blocks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        while (res != WAIT_IO_COMPLETION && m_connected && !m_closing) {
             res = WaitForSingleObjectEx(
                         m_overlapped.hEvent,
                         TIMEOUT,     // Time-out interval, in milliseconds.
                         TRUE);
-        } while (res != WAIT_IO_COMPLETION && m_connected && !m_closing);
+        }
         if (!m_connected || m_closing)
-            return;
+            break;
+        uint64_t completed = HidClock::now();
+        m_waitTotalNs.fetch_add(completed - issued, std::memory_order_relaxed);
+        HidTrace::span("read", "io", issued, completed, this);
 
         DWORD bytesTransferred = 0;
         BOOL overlappedResult = GetOverlappedResult(m_handle,
@@ -192,16 +427,249 @@ void HidDevice::readThread()
             continue;
         } else {
             ResetEvent(m_overlapped.hEvent);
-            if(m_callbackReadComplete)
-                m_callbackReadComplete(this);
+            reportReceived(buf, bytesTransferred);
         }
     } while (m_readContinuous && m_connected && !m_closing);
+
+    /* Let the dispatch thread drain the queue and exit */
+    if(m_queue)
+        m_queue->close();
     return;
 }
 
+bool HidDevice::spinRead()
+{
+    uint64_t budget = m_spinNs.load(std::memory_order_relaxed);
+    /* Spinning costs real time, also under a virtual clock */
+    uint64_t start = HidClock::steady();
+    uint64_t now = start;
+    bool done = false;
+
+    while (now - start < budget && m_connected && !m_closing) {
+        if(HasOverlappedIoCompleted(&m_overlapped)) {
+            done = true;
+            break;
+        }
+        YieldProcessor();
+        now = HidClock::steady();
+    }
+    m_spinTotalNs.fetch_add(now - start, std::memory_order_relaxed);
+
+    /* Halve the budget while reads outlast it, so an idle device does not
+     * keep a core busy, and grow it back by a quarter on every hit */
+    if(done)
+        budget = std::min(m_spinBudgetNs, budget + budget / 4 + 1);
+    else
+        budget = std::max<uint64_t>({m_spinBudgetNs / SPIN_BUDGET_MIN_DIV, budget / 2, 1});
+    m_spinNs.store(budget, std::memory_order_relaxed);
+
+    /* The completion routine is only queued, run it like the alertable wait would */
+    return done && SleepEx(0, TRUE) == WAIT_IO_COMPLETION;
+}
+
+HidDevice::WaitStats HidDevice::getWaitStats()
+{
+    WaitStats s;
+    s.spinHits = m_spinHits;
+    s.blocks = m_blocks;
+    s.spinNs = m_spinTotalNs;
+    s.waitNs = m_waitTotalNs;
+    s.budgetNs = m_spinNs;
+    return s;
+}
+
+void HidDevice::simulatedReadLoop(unsigned char *buf)
+{
+    do {
+        size_t length = 0;
+        uint64_t due = 0;
+        uint64_t issued = HidClock::now();
+        /* Time out like the driver read loop to notice closing */
+        while (!m_sim->read(buf, length, TIMEOUT, &due) && m_connected && !m_closing)
+            ;
+        if (!m_connected || m_closing)
+            break;
+
+        uint64_t completed = HidClock::now();
+        m_blocks.fetch_add(1, std::memory_order_relaxed);
+        m_waitTotalNs.fetch_add(completed - issued, std::memory_order_relaxed);
+        HidTrace::span("read", "io", issued, completed, this);
+        /* Virtual time may have moved past the report, keep the stamp independent of scheduling */
+        reportReceived(buf, length, HidClock::getVirtual() ? due : 0);
+    } while (m_readContinuous && m_connected && !m_closing);
+}
+
+void HidDevice::reportReceived(unsigned char *buf, size_t length, uint64_t now)
+{
+    HidTraceScope trace("report", "io", this);
+    /* One time stamp for all stages */
+    if(!now)
+        now = HidClock::now();
+
+    RoundTripProbe *probe = m_probe.load(std::memory_order_acquire);
+    if(probe)
+        probe->received(buf, length, now);
+    if(m_reconnectStart.load(std::memory_order_relaxed)) {
+        uint64_t start = m_reconnectStart.exchange(0);
+        if(start)
+            m_reconnectLatency = now - start;
+    }
+
+    ReportLogger *logger = m_logger.load(std::memory_order_acquire);
+    if(logger)
+        logger->log(this, buf, length, now);
+    ReportArchiveWriter *archive = m_archive.load(std::memory_order_acquire);
+    if(archive)
+        archive->append(m_archiveDevice, buf, length, now);
+
+    if(m_snapshotMode) {
+        std::shared_ptr<ReportSnapshot> snapshots = std::atomic_load(&m_snapshots);
+        if(snapshots)
+            snapshots->update(buf, length);
+    }
+
+    if(m_publisher)
+        m_publisher->publish(buf, length, now);
+
+    if(m_aggregator)
+        m_aggregator->add(buf, length, now);
+
+    std::shared_ptr<const ReportPredicate> reportFilter = std::atomic_load(&m_reportFilter);
+    if(reportFilter && !reportFilter->matches(buf, length)) {
+        m_filteredReports.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    /* Taken once, setters publish new sets instead of changing this one */
+    std::shared_ptr<const Handlers> handlers = std::atomic_load(&m_handlers);
+
+    std::shared_ptr<ChangeFilter> changeFilter = std::atomic_load(&m_changeFilter);
+    if(changeFilter) {
+        if(!changeFilter->changed(buf, length)) {
+            m_suppressedReports++;
+            return;
+        }
+        if(handlers->reportChanged)
+            handlers->reportChanged(this, buf, changeFilter->changedBits(), length);
+    }
+
+    /* Only the report callback may run concurrently with itself */
+    if(m_executor)
+        m_executor->post(this, m_executorShard, buf, length, m_orderInsensitive && handlers->report);
+    else if(m_queue)
+        m_queue->push(buf, length);
+    else
+        deliverReport(buf, length, *handlers);
+}
+
+void HidDevice::deliverReport(const unsigned char *buf, size_t length)
+{
+    deliverReport(buf, length, *std::atomic_load(&m_handlers));
+}
+
+void HidDevice::deliverReport(const unsigned char *buf, size_t length, const Handlers &handlers)
+{
+    HidTraceScope trace("callback", "callback", this);
+    if(handlers.report) {
+        handlers.report(this, buf, length);
+    } else if(handlers.readComplete) {
+        if(buf != m_readBuf)
+            memcpy(m_readBuf, buf, std::min(length, m_inputReportLength));
+        handlers.readComplete(this);
+    }
+}
+
+void HidDevice::setHandlers(const Handlers &handlers)
+{
+    std::lock_guard<std::mutex> lock(m_handlersMutex);
+    std::atomic_store(&m_handlers, std::shared_ptr<const Handlers>(std::make_shared<Handlers>(handlers)));
+}
+
+void HidDevice::setReportFilter(const ReportPredicate &predicate)
+{
+    std::shared_ptr<const ReportPredicate> filter;
+    if(!predicate.empty())
+        filter = std::make_shared<ReportPredicate>(predicate);
+    std::atomic_store(&m_reportFilter, filter);
+}
+
+void HidDevice::setChangeFilter(bool a)
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    m_changeFilterEnabled = a;
+    if(!m_streaming || a == bool(std::atomic_load(&m_changeFilter)))
+        return;
+
+    /* The read loop finishes the report it is comparing with the old filter */
+    std::shared_ptr<ChangeFilter> filter;
+    if(a)
+        filter = std::make_shared<ChangeFilter>(m_inputReportLength, m_changeIgnoreMask);
+    std::atomic_store(&m_changeFilter, filter);
+}
+
+void HidDevice::setChangeIgnoreMask(const unsigned char *mask, size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    m_changeIgnoreMask.assign(mask, mask + length);
+    std::shared_ptr<ChangeFilter> filter = std::atomic_load(&m_changeFilter);
+    if(filter)
+        filter->setIgnoreMask(m_changeIgnoreMask);
+}
+
+void HidDevice::setQueueDepth(size_t depth)
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    m_queueDepth = depth;
+    if(m_queue && depth > 0)
+        m_queue->setDepth(depth);
+}
+
+unsigned long long HidDevice::getDroppedReports()
+{
+    /* read() replaces the queue with the lock held */
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    return m_droppedReports + (m_queue ? m_queue->dropped() : 0);
+}
+
+void HidDevice::setOverflowPolicy(OverflowPolicy policy)
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    m_overflowPolicy = policy;
+    if(m_queue)
+        m_queue->setPolicy(policy);
+}
+
+void HidDevice::setArchive(ReportArchiveWriter *archive)
+{
+    m_archive = nullptr;
+    if(archive)
+        m_archiveDevice = archive->device(getPath());
+    m_archive = archive;
+}
+
+void HidDevice::setExecutor(CallbackExecutor *executor, bool orderInsensitive, int shard)
+{
+    m_pendingExecutor = executor;
+    m_orderInsensitive = orderInsensitive;
+    if(executor)
+        m_executorShard = shard < 0 ? executor->assign() : unsigned(shard) % executor->shards();
+}
+
+void HidDevice::dispatchThread()
+{
+    size_t length = 0;
+    while (m_queue->pop(m_readBuf, length))
+        deliverReport(m_readBuf, length);
+}
+
 bool HidDevice::read()
 {
-    if(m_readBlocking) {
+    if(m_readBlocking && m_sim) {
+        size_t length = 0;
+        while (!m_sim->read(m_readBuf, length, TIMEOUT))
+            if (!m_connected || m_closing)
+                return false;
+    } else if(m_readBlocking) {
         DWORD res;
         ReadFileEx(m_handle, m_readBuf, m_inputReportLength, &m_overlapped,
                    fileReadIOComplete);
@@ -226,13 +694,87 @@ bool HidDevice::read()
             ResetEvent(m_overlapped.hEvent);
         }
     } else {
+        /* The pipeline is rebuilt below, take the device off the reactor meanwhile */
+        HidDeviceGroup *group = m_group;
+        if(group) {
+            group->detach(this);
+            /* Let the dispatch thread finish, the reactor does not close the queue */
+            if(m_queue)
+                m_queue->close();
+        }
         if(m_readThread.joinable())
             m_readThread.join();
-        m_readThread = std::move(std::thread ([this](){this->readThread();}));
+        if(m_dispatchThread.joinable())
+            m_dispatchThread.join();
+
+        /* Published once and kept while the device lives, snapshot() may be
+         * running concurrently on other threads. */
+        if(m_snapshotMode && !std::atomic_load(&m_snapshots))
+            std::atomic_store(&m_snapshots, std::make_shared<ReportSnapshot>(m_inputReportLength));
+
+        /* Keep an existing ring so subscribers stay attached across reads,
+         * unless setPublisher() asked for another one */
+        if(m_publisher && (m_publisher->name() != m_publisherName
+                           || m_publisher->slotCount() != m_publisherSlots
+                           || m_publisher->slotSize() != m_inputReportLength))
+            m_publisher.reset();
+        if(m_publisherName.empty()) {
+            m_publisher.reset();
+        } else if(!m_publisher) {
+            m_publisher.reset(new ReportPublisher());
+            if(!m_publisher->create(m_publisherName, m_inputReportLength, m_publisherSlots))
+                m_publisher.reset();
+        }
+
+        m_aggregator.reset();
+        if(m_aggregateWindowUs)
+            m_aggregator.reset(new ReportAggregator(m_aggregateFields, m_aggregateWindowUs, m_aggregateHopUs,
+                                                    [this](const ReportAggregate &a) {
+                std::shared_ptr<const Handlers> handlers = getHandlers();
+                if(handlers->aggregate)
+                    handlers->aggregate(this, a);
+            }));
+
+        if(m_executor && m_executor != m_pendingExecutor)
+            m_executor->drain(this);
+        m_executor = m_pendingExecutor;
+
+        /* From here on filter and queue settings also apply while streaming */
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        std::shared_ptr<ChangeFilter> changeFilter;
+        if(m_changeFilterEnabled)
+            changeFilter = std::make_shared<ChangeFilter>(m_inputReportLength, m_changeIgnoreMask);
+        std::atomic_store(&m_changeFilter, changeFilter);
+        m_streaming = true;
+
+        /* The executor takes precedence over the queue, it queues itself */
+        if(m_queue)
+            m_droppedReports += m_queue->dropped();
+        m_queue.reset();
+        if(m_executor) {
+            m_ioBuf.resize(m_inputReportLength);
+        } else if(m_queueDepth > 0) {
+            m_ioBuf.resize(m_inputReportLength);
+            m_queue.reset(new ReportQueue(m_queueDepth, m_inputReportLength, m_overflowPolicy));
+            m_dispatchThread = std::thread ([this](){this->dispatchThread();});
+        }
+        if(group)
+            group->attach(this);
+        else
+            m_readThread = std::move(std::thread ([this](){this->readThread();}));
     }
     return true;
 }
 
+bool HidDevice::snapshot(unsigned char id, unsigned char *buf, size_t &length,
+                         unsigned long long *sequence)
+{
+    std::shared_ptr<ReportSnapshot> snapshots = std::atomic_load(&m_snapshots);
+    if(!snapshots)
+        return false;
+    return snapshots->read(id, buf, length, sequence);
+}
+
 void HidDevice::writeThread(LPVOID b)
 {
     DWORD res;
@@ -268,17 +810,28 @@ void HidDevice::writeThread(LPVOID b)
 #endif
     ResetEvent(m_overlapped.hEvent);
 
-    if(m_callbackWriteComplete)
-        m_callbackWriteComplete(this);
+    std::shared_ptr<const Handlers> handlers = getHandlers();
+    if(handlers->writeComplete)
+        handlers->writeComplete(this);
 
     return;
 }
 
 bool HidDevice::write(LPVOID b)
 {
+    HidTraceScope trace("write", "io", this);
     if(b == nullptr)
         return false;
 
+    if(m_sim) {
+        if(!isOpen() || !m_connected || !m_sim->write(b, m_outputReportLength))
+            return false;
+        std::shared_ptr<const Handlers> handlers = getHandlers();
+        if(!m_writeBlocking && handlers->writeComplete)
+            handlers->writeComplete(this);
+        return true;
+    }
+
     if(m_writeBlocking) {
         DWORD res;
         WriteFileEx(m_handle, b, m_outputReportLength, &m_overlapped,
@@ -320,6 +873,203 @@ bool HidDevice::write(LPVOID b)
     return true;
 }
 
+bool HidDevice::submitWrite(const void *b, size_t length)
+{
+    HidTraceScope trace("submit write", "io", this);
+    if(b == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_submitMutex);
+    if(!isOpen() || !m_connected || m_batchActive)
+        return false;
+    if(m_sim)
+        return m_sim->write(b, std::min(length, m_outputReportLength));
+    if(!finishSubmitted(false))
+        return false;
+
+    m_submitBuf.assign(m_outputReportLength, 0);
+    memcpy(m_submitBuf.data(), b, std::min(length, m_outputReportLength));
+
+    HANDLE event = m_submitOverlapped.hEvent;
+    ZeroMemory(&m_submitOverlapped, sizeof(m_submitOverlapped));
+    m_submitOverlapped.hEvent = event;
+    ResetEvent(event);
+
+    if(!WriteFile(m_handle, m_submitBuf.data(), m_outputReportLength, NULL, &m_submitOverlapped)
+            && GetLastError() != ERROR_IO_PENDING)
+        return false;
+
+    m_submitPending = true;
+    return true;
+}
+
+bool HidDevice::waitSubmitted(DWORD timeout)
+{
+    HANDLE event;
+    {
+        std::lock_guard<std::mutex> lock(m_submitMutex);
+        if(!m_submitPending)
+            return true;
+        event = m_submitOverlapped.hEvent;
+    }
+
+    if(WaitForSingleObject(event, timeout) != WAIT_OBJECT_0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_submitMutex);
+    return finishSubmitted(false);
+}
+
+bool HidDevice::writeLatest(const void *b, size_t length, int key)
+{
+    if(b == nullptr || length == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_coalescerMutex);
+    if(!isOpen())
+        return false;
+    if(!m_coalescer)
+        m_coalescer.reset(new WriteCoalescer([this](const unsigned char *r, size_t l){
+            bool submitted = submitWrite(r, l);
+            if(submitted && waitSubmitted(TIMEOUT))
+                return true;
+            /* Cancel our stalled write, or the newer report would be refused as busy */
+            if(submitted) {
+                std::lock_guard<std::mutex> lock(m_submitMutex);
+                finishSubmitted(true);
+            }
+            m_failedWrites.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }));
+
+    if(key < 0)
+        key = ((const unsigned char*)b)[0];
+    m_coalescer->post(key, (const unsigned char*)b, length);
+    return true;
+}
+
+unsigned long long HidDevice::getCoalescedWrites()
+{
+    std::lock_guard<std::mutex> lock(m_coalescerMutex);
+    return m_coalescer ? m_coalescer->coalesced() : 0;
+}
+
+bool HidDevice::writeBatch(const void *reports, size_t count, size_t *failed, unsigned int depth)
+{
+    HidTraceScope trace("write batch", "io", this);
+    if(failed)
+        *failed = 0;
+    if(reports == nullptr)
+        return false;
+
+    std::unique_lock<std::mutex> lock(m_submitMutex);
+    if(!isOpen() || !m_connected || m_batchActive)
+        return false;
+    if(m_sim) {
+        const unsigned char *base = (const unsigned char*)reports;
+        size_t i = 0;
+        while(i < count && m_sim->write(base + i * m_outputReportLength, m_outputReportLength))
+            i++;
+        if(failed)
+            *failed = i;
+        return i == count;
+    }
+
+    /* submitWrite() callers, e.g. OutputScheduler, must not wait for the
+     * whole batch: they find the device busy while the lock is released */
+    m_batchActive = true;
+    HANDLE submitted = m_submitPending ? m_submitOverlapped.hEvent : NULL;
+    lock.unlock();
+    bool ok = writeBatchUnlocked(reports, count, failed, depth, submitted);
+    lock.lock();
+    m_batchActive = false;
+    lock.unlock();
+    m_batchDone.notify_all();
+    return ok;
+}
+
+bool HidDevice::writeBatchUnlocked(const void *reports, size_t count, size_t *failed, unsigned int depth,
+                                   HANDLE submitted)
+{
+    if(submitted) {
+        WaitForSingleObject(submitted, TIMEOUT);
+        std::lock_guard<std::mutex> lock(m_submitMutex);
+        if(!finishSubmitted(false))
+            return false;
+    }
+
+    depth = std::max(1u, std::min<unsigned int>(depth, MAXIMUM_WAIT_OBJECTS));
+    std::vector<OVERLAPPED> overlapped(depth);
+    for(auto &o : overlapped) {
+        ZeroMemory(&o, sizeof(o));
+        o.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    /* Report i uses slot i % depth. HID writes complete in order, so it is
+     * enough to wait for the oldest report in flight. */
+    const unsigned char *base = (const unsigned char*)reports;
+    size_t next = 0, done = 0;
+    bool submitFailed = false, writeFailed = false;
+    while(done < count) {
+        while(!submitFailed && next < count && next - done < depth) {
+            OVERLAPPED &o = overlapped[next % depth];
+            HANDLE event = o.hEvent;
+            ZeroMemory(&o, sizeof(o));
+            o.hEvent = event;
+            if(event == NULL
+                    || (!WriteFile(m_handle, base + next * m_outputReportLength, m_outputReportLength, NULL, &o)
+                        && GetLastError() != ERROR_IO_PENDING)) {
+                submitFailed = true;
+                break;
+            }
+            next++;
+        }
+        /* Reports already in flight are still waited for after a failed submission */
+        if(done == next)
+            break;
+
+        OVERLAPPED &o = overlapped[done % depth];
+        DWORD bytesTransferred = 0;
+        if(WaitForSingleObject(o.hEvent, TIMEOUT) != WAIT_OBJECT_0)
+            CancelIoEx(m_handle, &o);
+        if(!GetOverlappedResult(m_handle, &o, &bytesTransferred, TRUE) || !bytesTransferred) {
+            writeFailed = true;
+            break;
+        }
+        done++;
+    }
+
+    /* Abandon whatever is still in flight after a failed write */
+    for(size_t i = done + 1; writeFailed && i < next; i++) {
+        DWORD bytesTransferred;
+        CancelIoEx(m_handle, &overlapped[i % depth]);
+        GetOverlappedResult(m_handle, &overlapped[i % depth], &bytesTransferred, TRUE);
+    }
+    for(auto &o : overlapped)
+        if(o.hEvent)
+            CloseHandle(o.hEvent);
+
+    if(failed)
+        *failed = done;
+    return done == count;
+}
+
+bool HidDevice::finishSubmitted(bool wait)
+{
+    if(!m_submitPending)
+        return true;
+
+    if(!wait && !HasOverlappedIoCompleted(&m_submitOverlapped))
+        return false;
+    if(wait)
+        CancelIoEx(m_handle, &m_submitOverlapped);
+
+    DWORD bytesTransferred = 0;
+    GetOverlappedResult(m_handle, &m_submitOverlapped, &bytesTransferred, TRUE);
+    m_submitPending = false;
+    return true;
+}
+
 /* XXX Completion routines are rather useless at the moment
  * as it does not seem to be possible to pass the device to
  * them. Should change to ReadFile/WriteFile? */
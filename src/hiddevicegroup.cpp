@@ -0,0 +1,272 @@
+#include "hiddevicegroup.h"
+#include "hidclock.h"
+#include "hiddevice.h"
+#include "hidtrace.h"
+
+#include <algorithm>
+
+//! A collection registered with the reactor
+struct HidDeviceGroup::Slot
+{
+    //! ReadFileEx leaves hEvent to the caller, it points back to the slot
+    OVERLAPPED overlapped;
+    HidDeviceGroup *group = nullptr;
+    HidDevice *device = nullptr;
+    //! Read buffer, owned by the slot so closing the device cannot free it under a read
+    std::vector<unsigned char> buf;
+    //! Time the pending read was issued
+    uint64_t issued = 0;
+    //! Set while a read is in flight
+    bool pending = false;
+    //! Set if a read could not be issued, until the collection is detached
+    bool failed = false;
+    //! Set once the collection is being dropped
+    bool detaching = false;
+};
+
+HidDeviceGroup::HidDeviceGroup(StringId container) :
+    m_container(container)
+{
+    m_wake = CreateEventW(NULL, FALSE, FALSE, NULL);
+}
+
+HidDeviceGroup::~HidDeviceGroup()
+{
+    stop();
+    if (m_wake)
+        CloseHandle(m_wake);
+}
+
+void HidDeviceGroup::add(HidDevice *device)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_devices.push_back(device);
+}
+
+std::vector<HidDevice*> HidDeviceGroup::getDevices()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_devices;
+}
+
+HidDevice *HidDeviceGroup::getCollection(unsigned short usagePage, unsigned short usage)
+{
+    for (HidDevice *device : getDevices())
+        if (device->getUsagePage() == usagePage && device->getUsage() == usage)
+            return device;
+    return nullptr;
+}
+
+bool HidDeviceGroup::open()
+{
+    bool ok = true;
+    for (HidDevice *device : getDevices())
+        if (!device->isOpen())
+            ok = device->open() && ok;
+    return ok;
+}
+
+bool HidDeviceGroup::close()
+{
+    bool ok = true;
+    for (HidDevice *device : getDevices())
+        if (device->isOpen())
+            ok = device->close() && ok;
+    stop();
+    return ok;
+}
+
+bool HidDeviceGroup::read()
+{
+    if (!m_wake)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            m_running = true;
+            m_thread = std::thread([this](){this->reactor();});
+            m_reactorId = m_thread.get_id();
+        }
+    }
+
+    bool ok = true;
+    for (HidDevice *device : getDevices()) {
+        if (!device->isOpen()) {
+            ok = false;
+            continue;
+        }
+        device->m_group = this;
+        device->setReadBlocking(false);
+        device->setReadContinuous(true);
+        ok = device->read() && ok;
+    }
+    return ok;
+}
+
+void HidDeviceGroup::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+            return;
+        m_stopping = true;
+    }
+    SetEvent(m_wake);
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (HidDevice *device : m_devices) {
+        device->m_group = nullptr;
+        device->m_attached = false;
+    }
+    m_requests.clear();
+    m_stopping = false;
+    m_running = false;
+}
+
+void HidDeviceGroup::attach(HidDevice *device)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running || m_stopping)
+            return;
+        device->m_attached = true;
+        m_requests.push_back(std::make_pair(device, true));
+    }
+    SetEvent(m_wake);
+}
+
+void HidDeviceGroup::detach(HidDevice *device)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!device->m_attached)
+        return;
+    m_requests.push_back(std::make_pair(device, false));
+    SetEvent(m_wake);
+
+    if (std::this_thread::get_id() == m_reactorId)
+        return;
+    m_detached.wait(lock, [device](){return !device->m_attached;});
+}
+
+bool HidDeviceGroup::applyRequests()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto &r : m_requests) {
+        HidDevice *device = r.first;
+        auto it = std::find_if(m_slots.begin(), m_slots.end(),
+                               [device](const std::unique_ptr<Slot> &s){return s->device == device;});
+        if (r.second && !m_stopping) {
+            if (it != m_slots.end()) {
+                /* Detached and attached again from a callback */
+                (*it)->detaching = false;
+                (*it)->failed = false;
+                continue;
+            }
+            std::unique_ptr<Slot> slot(new Slot());
+            slot->group = this;
+            slot->device = device;
+            slot->buf.resize(device->m_inputReportLength);
+            if (device->m_sim)
+                device->m_sim->setListener([this](){SetEvent(m_wake);});
+            m_slots.push_back(std::move(slot));
+        } else if (it != m_slots.end()) {
+            (*it)->detaching = true;
+        } else {
+            device->m_attached = false;
+        }
+    }
+    m_requests.clear();
+
+    bool dropped = false;
+    for (auto it = m_slots.begin(); it != m_slots.end();) {
+        Slot *slot = it->get();
+        if (m_stopping)
+            slot->detaching = true;
+        if (slot->detaching && slot->pending) {
+            /* The aborted read completes in the next alertable wait */
+            CancelIoEx(slot->device->m_handle, &slot->overlapped);
+            ++it;
+        } else if (slot->detaching) {
+            if (slot->device->m_sim)
+                slot->device->m_sim->setListener(nullptr);
+            slot->device->m_attached = false;
+            it = m_slots.erase(it);
+            dropped = true;
+        } else {
+            ++it;
+        }
+    }
+    if (dropped)
+        m_detached.notify_all();
+
+    return m_stopping && m_slots.empty();
+}
+
+void HidDeviceGroup::reactor()
+{
+    HidClock::Listener listener([this](){SetEvent(m_wake);});
+
+    while (!applyRequests()) {
+        uint64_t next = HidClock::now() + uint64_t(TIMEOUT) * 1000000;
+
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            Slot *slot = m_slots[i].get();
+            if (slot->detaching)
+                continue;
+
+            SimulatedDevice *sim = slot->device->getSimulated();
+            if (sim) {
+                size_t length = 0;
+                uint64_t due = 0;
+                uint64_t following = UINT64_MAX;
+                /* Under a virtual clock reports carry their due time, see HidDevice::simulatedReadLoop() */
+                while (!slot->detaching && sim->poll(slot->buf.data(), length, following, &due))
+                    deliver(slot, length, HidClock::getVirtual() ? due : 0);
+                next = std::min(next, following);
+            } else if (!slot->pending && !slot->failed) {
+                issue(slot);
+            }
+        }
+
+        /* Completion routines run during the wait, requests, simulated
+         * reports and the virtual clock set m_wake */
+        uint64_t now = HidClock::now();
+        DWORD ms = next > now ? DWORD((next - now + 999999) / 1000000) : 0;
+        WaitForSingleObjectEx(m_wake, ms, TRUE);
+    }
+}
+
+void HidDeviceGroup::issue(Slot *slot)
+{
+    ZeroMemory(&slot->overlapped, sizeof(slot->overlapped));
+    slot->overlapped.hEvent = slot;
+    slot->issued = HidClock::now();
+    slot->pending = ReadFileEx(slot->device->m_handle, slot->buf.data(), DWORD(slot->buf.size()),
+                               &slot->overlapped, readComplete) != FALSE;
+    slot->failed = !slot->pending;
+}
+
+VOID WINAPI HidDeviceGroup::readComplete(DWORD error, DWORD bytes, LPOVERLAPPED overlapped)
+{
+    Slot *slot = static_cast<Slot*>(overlapped->hEvent);
+    slot->pending = false;
+    if (error == ERROR_SUCCESS && bytes && !slot->detaching)
+        slot->group->deliver(slot, bytes);
+}
+
+void HidDeviceGroup::deliver(Slot *slot, size_t length, uint64_t now)
+{
+    if (!now)
+        now = HidClock::now();
+    if (!slot->device->getSimulated())
+        HidTrace::span("read", "io", slot->issued, now, slot->device);
+    m_reports.fetch_add(1, std::memory_order_relaxed);
+
+    std::shared_ptr<const ReportCallback> cb = std::atomic_load(&m_callbackReport);
+    if (*cb)
+        (*cb)(slot->device, slot->buf.data(), length, now);
+    slot->device->reportReceived(slot->buf.data(), length, now);
+}
@@ -0,0 +1,139 @@
+#include <winsock2.h>
+
+#include "hidprotocol.h"
+
+#include <algorithm>
+
+void HidFrameWriter::begin(uint16_t type)
+{
+    m_start = m_buf.size();
+    HidFrameHeader h = {0, type, 0};
+    put(&h, sizeof(h));
+}
+
+void HidFrameWriter::end()
+{
+    header()->length = (uint32_t)(m_buf.size() - m_start - sizeof(HidFrameHeader));
+}
+
+void HidFrameWriter::put(const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    m_buf.insert(m_buf.end(), p, p + length);
+}
+
+void HidFrameWriter::putString(const std::wstring &s)
+{
+    /* UTF-16 code units, wchar_t is 16 bits on Windows */
+    put16((uint16_t)s.size());
+    for (wchar_t c : s)
+        put16((uint16_t)c);
+}
+
+void HidFrameWriter::putReport(uint32_t device, const unsigned char *report, size_t length)
+{
+    put32(device);
+    put16((uint16_t)length);
+    put(report, length);
+    record();
+}
+
+void HidFrameWriter::putDeviceInfo(const HidDeviceInfo &info)
+{
+    put32(info.id);
+    put16(info.vid);
+    put16(info.pid);
+    put16(info.versionNumber);
+    put16(info.usagePage);
+    put16(info.usage);
+    put16(info.inputReportLength);
+    put16(info.outputReportLength);
+    put8(info.connected);
+    putString(info.path);
+    putString(info.manufacturer);
+    putString(info.product);
+    putString(info.serialNumber);
+    record();
+}
+
+bool HidFrameReader::get(void *data, size_t length)
+{
+    if (m_length - m_pos < length)
+        return false;
+    memcpy(data, m_data + m_pos, length);
+    m_pos += length;
+    return true;
+}
+
+bool HidFrameReader::getString(std::wstring &s)
+{
+    uint16_t n;
+    if (!get16(n))
+        return false;
+    s.resize(n);
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t c;
+        if (!get16(c))
+            return false;
+        s[i] = (wchar_t)c;
+    }
+    return true;
+}
+
+bool HidFrameReader::getReport(uint32_t &device, const unsigned char *&report, size_t &length)
+{
+    uint16_t n;
+    if (!get32(device) || !get16(n) || m_length - m_pos < n)
+        return false;
+    report = m_data + m_pos;
+    length = n;
+    m_pos += n;
+    return true;
+}
+
+bool HidFrameReader::getDeviceInfo(HidDeviceInfo &info)
+{
+    uint8_t connected = 0;
+    bool res = get32(info.id) && get16(info.vid) && get16(info.pid)
+            && get16(info.versionNumber) && get16(info.usagePage) && get16(info.usage)
+            && get16(info.inputReportLength) && get16(info.outputReportLength)
+            && get8(connected)
+            && getString(info.path) && getString(info.manufacturer)
+            && getString(info.product) && getString(info.serialNumber);
+    info.connected = connected != 0;
+    return res;
+}
+
+bool hidSendAll(uintptr_t socket, const unsigned char *data, size_t length)
+{
+    while (length > 0) {
+        int n = send((SOCKET)socket, (const char*)data, (int)std::min<size_t>(length, 1 << 30), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool recvAll(uintptr_t socket, unsigned char *data, size_t length)
+{
+    while (length > 0) {
+        int n = recv((SOCKET)socket, (char*)data, (int)std::min<size_t>(length, 1 << 30), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool hidRecvFrame(uintptr_t socket, HidFrameHeader &header, std::vector<unsigned char> &payload)
+{
+    if (!recvAll(socket, (unsigned char*)&header, sizeof(header)))
+        return false;
+    if (header.length > HID_FRAME_MAX)
+        return false;
+    payload.resize(header.length);
+    return recvAll(socket, payload.data(), header.length);
+}
@@ -0,0 +1,379 @@
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "hidserver.h"
+
+HidServer::HidServer(HidApi &api) :
+    m_api(api),
+    m_listen((uintptr_t)INVALID_SOCKET)
+{
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+}
+
+HidServer::~HidServer()
+{
+    stop();
+    WSACleanup();
+}
+
+bool HidServer::start(const std::string &socketPath)
+{
+    if (m_acceptThread.joinable())
+        return false;
+
+    sockaddr_un addr;
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return false;
+
+    DeleteFileA(socketPath.c_str());
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+            || listen(s, SOMAXCONN) == SOCKET_ERROR) {
+        closesocket(s);
+        return false;
+    }
+
+    m_listen = (uintptr_t)s;
+    m_socketPath = socketPath;
+    m_stopping = false;
+
+    m_api.setCallbackArrival([this](HidDevice *d){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<unsigned char> frame;
+        HidFrameWriter w(frame);
+        w.begin(HID_MSG_ARRIVAL);
+        w.putDeviceInfo(info(idOf(d), d));
+        w.end();
+        for (auto &c : m_clients)
+            queueFrame(c.get(), frame);
+    });
+    m_api.setCallbackRemoval([this](HidDevice *d){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<unsigned char> frame;
+        HidFrameWriter w(frame);
+        w.begin(HID_MSG_REMOVAL);
+        w.put32(idOf(d));
+        w.end();
+        for (auto &c : m_clients)
+            queueFrame(c.get(), frame);
+    });
+
+    m_acceptThread = std::thread([this](){this->acceptThread();});
+    return true;
+}
+
+void HidServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    if (m_listen != (uintptr_t)INVALID_SOCKET) {
+        closesocket((SOCKET)m_listen);
+        m_listen = (uintptr_t)INVALID_SOCKET;
+    }
+    if (m_acceptThread.joinable())
+        m_acceptThread.join();
+    else
+        return;
+
+    m_api.setCallbackArrival(nullptr);
+    m_api.setCallbackRemoval(nullptr);
+
+    /* Readers clean up their devices when their socket is shut down */
+    std::list<std::unique_ptr<Client>> clients;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        clients.swap(m_clients);
+        for (auto &c : clients)
+            shutdown((SOCKET)c->socket, SD_BOTH);
+    }
+    for (auto &c : clients)
+        c->reader.join();
+
+    DeleteFileA(m_socketPath.c_str());
+}
+
+void HidServer::acceptThread()
+{
+    while (true) {
+        SOCKET s = accept((SOCKET)m_listen, NULL, NULL);
+        if (s == INVALID_SOCKET)
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            closesocket(s);
+            return;
+        }
+        reap();
+
+        Client *c = new Client;
+        c->socket = (uintptr_t)s;
+        m_clients.push_back(std::unique_ptr<Client>(c));
+        c->sender = std::thread([this, c](){this->senderThread(c);});
+        c->reader = std::thread([this, c](){this->readerThread(c);});
+    }
+}
+
+void HidServer::readerThread(Client *c)
+{
+    HidFrameHeader h;
+    std::vector<unsigned char> payload;
+
+    while (hidRecvFrame(c->socket, h, payload)) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        handle(c, h, payload, lock);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::set<uint32_t> opened = c->opened;
+        for (uint32_t id : opened)
+            detach(c, id);
+    }
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->closing = true;
+    }
+    c->cv.notify_all();
+    c->sender.join();
+    closesocket((SOCKET)c->socket);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    c->done = true;
+}
+
+void HidServer::senderThread(Client *c)
+{
+    std::vector<unsigned char> buf;
+    std::unique_lock<std::mutex> lock(c->mutex);
+
+    while (true) {
+        c->cv.wait(lock, [c](){return c->closing || !c->out.empty();});
+        if (c->closing)
+            return;
+
+        /* Everything queued while the previous send was in progress goes out
+         * in one call, reports in one frame. */
+        buf.swap(c->out);
+        c->reportsFrame = SIZE_MAX;
+
+        lock.unlock();
+        bool res = hidSendAll(c->socket, buf.data(), buf.size());
+        buf.clear();
+        lock.lock();
+
+        if (!res) {
+            c->closing = true;
+            shutdown((SOCKET)c->socket, SD_BOTH);
+            return;
+        }
+    }
+}
+
+void HidServer::handle(Client *c, const HidFrameHeader &h, const std::vector<unsigned char> &payload,
+                       std::unique_lock<std::mutex> &lock)
+{
+    HidFrameReader r(payload.data(), payload.size());
+    std::vector<unsigned char> frame;
+    HidFrameWriter w(frame);
+
+    switch (h.type) {
+    case HID_MSG_ENUMERATE: {
+        std::shared_ptr<const HidDeviceMap> devices = m_api.devices();
+        w.begin(HID_MSG_DEVICES);
+        for (auto &x : *devices)
+            w.putDeviceInfo(info(idOf(x.second.get()), x.second.get()));
+        w.end();
+        queueFrame(c, frame);
+        break;
+    }
+    case HID_MSG_OPEN: {
+        uint32_t id;
+        if (!r.get32(id))
+            break;
+
+        bool res = false;
+        auto it = m_devices.find(id);
+        if (it != m_devices.end()) {
+            Device &dev = it->second;
+            HidDevice *d = dev.device;
+            res = c->opened.count(id) > 0;
+
+            bool first;
+            {
+                std::lock_guard<std::mutex> lock(m_subscribersMutex);
+                first = dev.clients.empty();
+            }
+            if (!res && first && d->isConnected() && (d->isOpen() || d->open())) {
+                d->setCallbackReport([this, id](HidDevice*, const unsigned char *report, size_t length){this->report(id, report, length);});
+                d->setReadBlocking(false);
+                d->setReadContinuous(true);
+                d->setAutoReconnect(true);
+                d->read();
+                res = true;
+            } else if (!res && !first) {
+                res = true;
+            }
+
+            if (res) {
+                std::lock_guard<std::mutex> lock(m_subscribersMutex);
+                dev.clients.insert(c);
+                c->opened.insert(id);
+            }
+        }
+
+        w.begin(HID_MSG_OPENED);
+        w.put32(id);
+        w.put8(res);
+        w.end();
+        queueFrame(c, frame);
+        break;
+    }
+    case HID_MSG_CLOSE: {
+        uint32_t id;
+        if (r.get32(id) && c->opened.count(id))
+            detach(c, id);
+        break;
+    }
+    case HID_MSG_WRITE: {
+        uint32_t id;
+        const unsigned char *data;
+        size_t length;
+        std::vector<std::pair<HidDevice*, std::pair<const unsigned char*, size_t>>> writes;
+        for (uint16_t i = 0; i < h.count && r.getReport(id, data, length); i++) {
+            if (c->opened.count(id))
+                writes.push_back(std::make_pair(m_devices[id].device, std::make_pair(data, length)));
+        }
+
+        /* A slow device must not stall other clients and hotplug. The devices
+         * stay open, only this client's reader could close them. */
+        lock.unlock();
+        for (auto &x : writes) {
+            if (x.first->submitWrite(x.second.first, x.second.second))
+                x.first->waitSubmitted(TIMEOUT);
+        }
+        lock.lock();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void HidServer::report(uint32_t id, const unsigned char *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_subscribersMutex);
+    auto it = m_devices.find(id);
+    if (it == m_devices.end())
+        return;
+
+    for (Client *c : it->second.clients) {
+        {
+            std::lock_guard<std::mutex> clientLock(c->mutex);
+            if (c->closing || c->out.size() > HID_CLIENT_BUFFER_MAX)
+                continue;
+
+            HidFrameWriter w(c->out);
+            if (c->reportsFrame != SIZE_MAX)
+                w.resume(c->reportsFrame);
+            /* Split like RemoteDevice::writeBatch(), clients drop frames over HID_FRAME_MAX */
+            if (c->reportsFrame == SIZE_MAX || w.count() == UINT16_MAX || w.size() + length > HID_FRAME_MAX) {
+                c->reportsFrame = c->out.size();
+                w.begin(HID_MSG_REPORTS);
+            }
+            w.putReport(id, data, length);
+            w.end();
+        }
+        c->cv.notify_one();
+    }
+}
+
+void HidServer::queueFrame(Client *c, const std::vector<unsigned char> &frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if (c->closing)
+            return;
+        c->out.insert(c->out.end(), frame.begin(), frame.end());
+        c->reportsFrame = SIZE_MAX;
+    }
+    c->cv.notify_one();
+}
+
+void HidServer::detach(Client *c, uint32_t id)
+{
+    c->opened.erase(id);
+
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+        std::set<Client*> &clients = m_devices[id].clients;
+        clients.erase(c);
+        last = clients.empty();
+    }
+
+    /* The read loop only takes m_subscribersMutex, so it can finish while
+     * we wait for it here. */
+    HidDevice *d = m_devices[id].device;
+    if (last) {
+        d->setAutoReconnect(false);
+        d->setReadContinuous(false);
+        if (d->isOpen())
+            d->close();
+    }
+}
+
+uint32_t HidServer::idOf(HidDevice *d)
+{
+    auto it = m_ids.find(d);
+    if (it != m_ids.end())
+        return it->second;
+
+    uint32_t id = m_nextId++;
+    m_ids[d] = id;
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+        m_devices[id].device = d;
+    }
+    return id;
+}
+
+HidDeviceInfo HidServer::info(uint32_t id, HidDevice *d)
+{
+    HidDeviceInfo i;
+    i.id = id;
+    i.vid = d->getVid();
+    i.pid = d->getPid();
+    i.versionNumber = d->getVersionNumber();
+    i.usagePage = d->getUsagePage();
+    i.usage = d->getUsage();
+    i.inputReportLength = (uint16_t)d->getInputReportLength();
+    i.outputReportLength = (uint16_t)d->getOutputReportLength();
+    i.connected = d->isConnected();
+    i.path = d->getPath();
+    i.manufacturer = d->getManufacturer();
+    i.product = d->getProduct();
+    i.serialNumber = d->getSerialNumber();
+    return i;
+}
+
+void HidServer::reap()
+{
+    for (auto it = m_clients.begin(); it != m_clients.end();) {
+        if ((*it)->done) {
+            (*it)->reader.join();
+            it = m_clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
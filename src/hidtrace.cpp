@@ -0,0 +1,203 @@
+#include "hidtrace.h"
+#include "hidclock.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Events are complete ('X') events with a duration, instants have none */
+struct HidTraceEvent
+{
+    const char *name;
+    const char *category;
+    const void *id;
+    uint64_t start;
+    uint64_t duration;
+    bool instant;
+};
+
+struct HidTraceBuffer
+{
+    std::vector<HidTraceEvent> events;
+    //! Number of events recorded since epoch, the ring holds the last events.size()
+    std::atomic<uint64_t> count {0};
+    //! start() the events belong to, only the owner thread resets count
+    std::atomic<uint64_t> epoch {0};
+    DWORD tid = 0;
+    std::atomic<bool> exited {false};
+};
+
+/* Marks the buffer of a thread as orphaned when the thread exits, the
+ * events stay around until the next start() */
+struct HidTraceThread
+{
+    std::shared_ptr<HidTraceBuffer> buffer;
+    ~HidTraceThread()
+    {
+        if (buffer)
+            buffer->exited = true;
+    }
+};
+
+static std::mutex s_buffersMutex;
+static std::vector<std::shared_ptr<HidTraceBuffer>> s_buffers;
+static size_t s_eventsPerThread = 65536;
+//! Incremented by every start(), buffers of an older epoch are cleared by their owner
+static std::atomic<uint64_t> s_epoch {0};
+static thread_local HidTraceThread s_thread;
+
+std::atomic<bool> HidTrace::s_enabled {false};
+
+static HidTraceBuffer *threadBuffer()
+{
+    if (!s_thread.buffer) {
+        std::shared_ptr<HidTraceBuffer> b(new HidTraceBuffer());
+        b->tid = GetCurrentThreadId();
+        b->epoch = s_epoch.load();
+        std::lock_guard<std::mutex> lock(s_buffersMutex);
+        b->events.resize(std::max<size_t>(s_eventsPerThread, 1));
+        s_buffers.push_back(b);
+        s_thread.buffer = b;
+    }
+    return s_thread.buffer.get();
+}
+
+static void record(const char *name, const char *category, const void *id,
+                   uint64_t start, uint64_t duration, bool instant)
+{
+    HidTraceBuffer *b = threadBuffer();
+    /* Clear the events of an earlier trace here rather than in start(),
+     * which would race with the count update below */
+    uint64_t epoch = s_epoch.load(std::memory_order_acquire);
+    if (b->epoch.load(std::memory_order_relaxed) != epoch) {
+        b->count.store(0, std::memory_order_relaxed);
+        b->epoch.store(epoch, std::memory_order_release);
+    }
+    uint64_t n = b->count.load(std::memory_order_relaxed);
+    HidTraceEvent &e = b->events[n % b->events.size()];
+    e.name = name;
+    e.category = category;
+    e.id = id;
+    e.start = start;
+    e.duration = duration;
+    e.instant = instant;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+void HidTrace::start(size_t eventsPerThread)
+{
+    std::lock_guard<std::mutex> lock(s_buffersMutex);
+    s_eventsPerThread = eventsPerThread;
+    s_buffers.erase(std::remove_if(s_buffers.begin(), s_buffers.end(),
+                                   [](const std::shared_ptr<HidTraceBuffer> &b){return b->exited.load();}),
+                    s_buffers.end());
+    s_epoch++;
+    s_enabled = true;
+}
+
+void HidTrace::stop()
+{
+    s_enabled = false;
+}
+
+void HidTrace::span(const char *name, const char *category, uint64_t start, uint64_t end, const void *id)
+{
+    if (!enabled())
+        return;
+    record(name, category, id, start, end > start ? end - start : 0, false);
+}
+
+void HidTrace::instant(const char *name, const char *category, const void *id)
+{
+    if (!enabled())
+        return;
+    record(name, category, id, HidClock::now(), 0, true);
+}
+
+/* Names are literals in practice, escape anyway to always produce valid JSON */
+static void writeString(std::ostream &out, const char *s)
+{
+    out << '"';
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\')
+            out << '\\' << *s;
+        else if ((unsigned char)*s >= 0x20)
+            out << *s;
+    }
+    out << '"';
+}
+
+bool HidTrace::dump(std::ostream &out)
+{
+    std::vector<std::shared_ptr<HidTraceBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(s_buffersMutex);
+        buffers = s_buffers;
+    }
+    uint64_t epoch = s_epoch.load(std::memory_order_acquire);
+
+    DWORD pid = GetCurrentProcessId();
+    char num[64];
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (auto &b : buffers) {
+        /* Threads that recorded nothing since start() still hold older events */
+        if (b->epoch.load(std::memory_order_acquire) != epoch)
+            continue;
+        uint64_t count = b->count.load(std::memory_order_acquire);
+        uint64_t size = b->events.size();
+        uint64_t begin = count > size ? count - size : 0;
+        for (uint64_t i = begin; i < count; i++) {
+            const HidTraceEvent &e = b->events[i % size];
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            first = false;
+            writeString(out, e.name);
+            out << ",\"cat\":";
+            writeString(out, e.category);
+            /* Trace-event times are microseconds, keep the nanoseconds as decimals */
+            snprintf(num, sizeof(num), "%llu.%03u", (unsigned long long)(e.start / 1000), unsigned(e.start % 1000));
+            out << ",\"ph\":\"" << (e.instant ? "i" : "X") << "\",\"ts\":" << num;
+            if (e.instant) {
+                out << ",\"s\":\"t\"";
+            } else {
+                snprintf(num, sizeof(num), "%llu.%03u", (unsigned long long)(e.duration / 1000), unsigned(e.duration % 1000));
+                out << ",\"dur\":" << num;
+            }
+            out << ",\"pid\":" << pid << ",\"tid\":" << b->tid;
+            if (e.id) {
+                snprintf(num, sizeof(num), "%p", e.id);
+                out << ",\"args\":{\"id\":\"" << num << "\"}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+bool HidTrace::dump(const std::string &path)
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::trunc);
+    if (!out)
+        return false;
+    return dump(out);
+}
+
+HidTraceScope::HidTraceScope(const char *name, const char *category, const void *id) :
+    m_name(name),
+    m_category(category),
+    m_id(id),
+    m_start(HidTrace::enabled() ? HidClock::now() : 0)
+{
+}
+
+HidTraceScope::~HidTraceScope()
+{
+    if (m_start)
+        HidTrace::span(m_name, m_category, m_start, HidClock::now(), m_id);
+}
@@ -0,0 +1,118 @@
+#include "hotplugpipeline.h"
+#include "hidclock.h"
+
+#include <algorithm>
+#include <chrono>
+
+HotplugPipeline::HotplugPipeline(unsigned int workers, Handler handler, std::function<void()> batchComplete) :
+    m_handler(handler),
+    m_batchComplete(batchComplete)
+{
+    for (unsigned int i = 0; i < std::max(workers, 1u); i++)
+        m_workers.push_back(std::thread([this](){this->worker();}));
+    m_coordinator = std::thread([this](){this->coordinator();});
+}
+
+HotplugPipeline::~HotplugPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_tasks.clear();
+    }
+    m_eventCv.notify_all();
+    m_taskCv.notify_all();
+    m_doneCv.notify_all();
+
+    m_coordinator.join();
+    for (auto &t : m_workers)
+        t.join();
+}
+
+void HotplugPipeline::post(DeviceId device, bool present)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_pending.find(device);
+        if (it == m_pending.end())
+            it = m_pending.insert(std::make_pair(device, Pending{present, false, 0})).first;
+
+        it->second.present = present;
+        it->second.sawRemoval |= !present;
+        it->second.deadline = HidClock::now() + m_debounceNs;
+    }
+    m_eventCv.notify_one();
+}
+
+void HotplugPipeline::setDebounce(unsigned int ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_debounceNs = (uint64_t)ms * 1000000;
+}
+
+void HotplugPipeline::coordinator()
+{
+    /* Debounce deadlines may be virtual, wake up when the clock moves. Created
+     * before locking m_mutex, the clock's lock orders before it. */
+    HidClock::Listener listener([this](){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_eventCv.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_stopping) {
+        if (m_pending.empty()) {
+            m_eventCv.wait(lock, [this](){return m_stopping || !m_pending.empty();});
+            continue;
+        }
+
+        uint64_t now = HidClock::now();
+        uint64_t earliest = UINT64_MAX;
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            if (it->second.deadline <= now) {
+                m_tasks.push_back(*it);
+                it = m_pending.erase(it);
+            } else {
+                earliest = std::min(earliest, it->second.deadline);
+                ++it;
+            }
+        }
+
+        if (m_tasks.empty()) {
+            m_eventCv.wait_for(lock, std::chrono::nanoseconds(earliest - now));
+            continue;
+        }
+
+        m_unfinished = m_tasks.size();
+        m_taskCv.notify_all();
+        m_doneCv.wait(lock, [this](){return m_stopping || m_unfinished == 0;});
+        if (m_stopping)
+            break;
+
+        lock.unlock();
+        if (m_batchComplete)
+            m_batchComplete();
+        lock.lock();
+    }
+}
+
+void HotplugPipeline::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_taskCv.wait(lock, [this](){return m_stopping || !m_tasks.empty();});
+        if (m_stopping)
+            return;
+
+        std::pair<DeviceId, Pending> task = m_tasks.front();
+        m_tasks.pop_front();
+
+        lock.unlock();
+        m_handler(task.first, task.second.present, task.second.sawRemoval);
+        lock.lock();
+
+        if (--m_unfinished == 0)
+            m_doneCv.notify_one();
+    }
+}
@@ -0,0 +1,57 @@
+#include "hotplugsource.h"
+
+extern "C"
+{
+#include <hidsdi.h>
+}
+
+DeviceInterfaceSource::~DeviceInterfaceSource()
+{
+    stop();
+}
+
+bool DeviceInterfaceSource::start(Sink sink)
+{
+    stop();
+    m_sink = sink;
+
+    CM_NOTIFY_FILTER filter;
+    ZeroMemory(&filter, sizeof(filter));
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+
+    if (CM_Register_Notification(&filter, this, s_notify, &m_notification) != CR_SUCCESS) {
+        m_notification = NULL;
+        return false;
+    }
+    return true;
+}
+
+void DeviceInterfaceSource::stop()
+{
+    /* Waits for callbacks in progress to return */
+    if (m_notification != NULL)
+        CM_Unregister_Notification(m_notification);
+    m_notification = NULL;
+}
+
+DWORD CALLBACK DeviceInterfaceSource::s_notify(HCMNOTIFICATION hNotify, PVOID context, CM_NOTIFY_ACTION action,
+                                               PCM_NOTIFY_EVENT_DATA data, DWORD size)
+{
+    (void)hNotify;
+    (void)size;
+    DeviceInterfaceSource *pThis = static_cast<DeviceInterfaceSource*>(context);
+
+    switch (action) {
+    case CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL:
+        pThis->m_sink(data->u.DeviceInterface.SymbolicLink, true);
+        break;
+    case CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL:
+        pThis->m_sink(data->u.DeviceInterface.SymbolicLink, false);
+        break;
+    default:
+        break;
+    }
+    return ERROR_SUCCESS;
+}
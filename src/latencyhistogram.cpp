@@ -0,0 +1,91 @@
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+/* Values below 1 << HISTOGRAM_PRECISION_BITS have a bucket each. Above, a value
+ * with its highest set bit at position S - 1 + b is shifted right by b, which
+ * leaves HISTOGRAM_PRECISION_BITS - 1 bits below the highest one to pick the
+ * sub-bucket. */
+#define SUB_BUCKETS (1u << HISTOGRAM_PRECISION_BITS)
+#define HALF_BUCKETS (SUB_BUCKETS / 2)
+#define MAX_SHIFT (HISTOGRAM_MAX_BITS - HISTOGRAM_PRECISION_BITS)
+#define BUCKETS (SUB_BUCKETS + MAX_SHIFT * HALF_BUCKETS)
+
+LatencyHistogram::LatencyHistogram() :
+    m_buckets(BUCKETS)
+{
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return size_t(value);
+
+    unsigned int shift = 1;
+    while (value >> (shift + HISTOGRAM_PRECISION_BITS))
+        shift++;
+    if (shift > MAX_SHIFT)
+        return BUCKETS - 1;
+    return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + size_t((value >> shift) - HALF_BUCKETS);
+}
+
+uint64_t LatencyHistogram::upperBound(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    unsigned int shift = unsigned((bucket - SUB_BUCKETS) / HALF_BUCKETS) + 1;
+    uint64_t sub = (bucket - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    m_buckets[bucketOf(value)]++;
+    if (!m_count || value < m_min)
+        m_min = value;
+    if (value > m_max)
+        m_max = value;
+    m_sum += value;
+    m_count++;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (!other.m_count)
+        return;
+    for (size_t i = 0; i < m_buckets.size(); i++)
+        m_buckets[i] += other.m_buckets[i];
+    if (!m_count || other.m_min < m_min)
+        m_min = other.m_min;
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), 0);
+    m_count = 0;
+    m_min = 0;
+    m_max = 0;
+    m_sum = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (!m_count)
+        return 0;
+    p = std::min(std::max(p, 0.0), 100.0);
+    unsigned long long target = std::max<unsigned long long>(
+                (unsigned long long)std::ceil(p / 100.0 * m_count), 1);
+
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < m_buckets.size(); i++) {
+        seen += m_buckets[i];
+        if (seen >= target)
+            return std::min(upperBound(i), m_max);
+    }
+    return m_max;
+}
@@ -0,0 +1,147 @@
+#include "outputscheduler.h"
+#include "hidclock.h"
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+OutputScheduler::OutputScheduler()
+{
+    /* High resolution timers need Windows 10 1803, fall back to a regular one */
+    m_timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (m_timer == NULL)
+        m_timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    m_wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+}
+
+OutputScheduler::~OutputScheduler()
+{
+    stop();
+    if (m_timer)
+        CloseHandle(m_timer);
+    if (m_wakeEvent)
+        CloseHandle(m_wakeEvent);
+}
+
+int OutputScheduler::add(HidDevice *device, const unsigned char *report, size_t length, unsigned long periodUs)
+{
+    if (device == nullptr || periodUs == 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int id = m_nextId++;
+    Stream &s = m_streams[id];
+    s.device = device;
+    s.report.assign(report, report + length);
+    s.periodNs = (uint64_t)periodUs * 1000;
+    s.deadline = HidClock::now() + s.periodNs;
+    m_deadlines.push(Deadline{s.deadline, id});
+
+    SetEvent(m_wakeEvent);
+    return id;
+}
+
+bool OutputScheduler::update(int id, const unsigned char *report, size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it == m_streams.end())
+        return false;
+    it->second.report.assign(report, report + length);
+    return true;
+}
+
+bool OutputScheduler::remove(int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* The stale deadline is skipped when it comes up */
+    return m_streams.erase(id) > 0;
+}
+
+bool OutputScheduler::stats(int id, Stats &s)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it == m_streams.end())
+        return false;
+    s = it->second.stats;
+    return true;
+}
+
+void OutputScheduler::start()
+{
+    if (m_thread.joinable())
+        return;
+    m_stopping = false;
+    m_thread = std::thread([this](){this->run();});
+}
+
+void OutputScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    SetEvent(m_wakeEvent);
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void OutputScheduler::run()
+{
+    HANDLE handles[2] = {m_timer, m_wakeEvent};
+    /* The timer runs on real time, re-check deadlines whenever virtual time moves */
+    HidClock::Listener listener([this](){SetEvent(m_wakeEvent);});
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_stopping) {
+        if (m_deadlines.empty()) {
+            lock.unlock();
+            WaitForSingleObject(m_wakeEvent, INFINITE);
+            lock.lock();
+            continue;
+        }
+
+        Deadline next = m_deadlines.top();
+        auto it = m_streams.find(next.id);
+        if (it == m_streams.end()) {
+            m_deadlines.pop();
+            continue;
+        }
+
+        uint64_t now = HidClock::now();
+        if (next.time > now) {
+            /* Relative due time in 100 ns units */
+            LARGE_INTEGER due;
+            due.QuadPart = -(LONGLONG)((next.time - now + 99) / 100);
+            SetWaitableTimer(m_timer, &due, 0, NULL, NULL, FALSE);
+            lock.unlock();
+            WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            lock.lock();
+            continue;
+        }
+
+        m_deadlines.pop();
+        serve(it->second, now);
+        m_deadlines.push(Deadline{it->second.deadline, next.id});
+    }
+}
+
+void OutputScheduler::serve(Stream &s, uint64_t now)
+{
+    uint64_t late = now - s.deadline;
+
+    if (s.device->submitWrite(s.report.data(), s.report.size())) {
+        s.stats.sent++;
+        s.stats.jitterSumNs += late;
+        if (late > s.stats.jitterMaxNs)
+            s.stats.jitterMaxNs = late;
+    } else {
+        s.stats.busy++;
+    }
+
+    /* Stay on the original phase, skipping periods that are already over */
+    uint64_t skipped = late / s.periodNs;
+    s.stats.missed += skipped;
+    s.deadline += (skipped + 1) * s.periodNs;
+}
@@ -0,0 +1,109 @@
+#include "reportaggregator.h"
+
+#include <algorithm>
+
+ReportAggregator::ReportAggregator(const ReportFieldTable &fields, uint64_t windowUs,
+                                   uint64_t hopUs, Callback cb) :
+    m_table(fields),
+    m_fieldsOfId(256),
+    m_callback(cb)
+{
+    windowUs = std::max<uint64_t>(windowUs, 1);
+    if (!hopUs || hopUs > windowUs)
+        hopUs = windowUs;
+    m_hopNs = hopUs * 1000;
+
+    size_t panes = size_t((windowUs + hopUs - 1) / hopUs);
+    m_panes.resize(panes);
+    for (auto &p : m_panes)
+        p.fields.resize(m_table.size());
+    m_out.fields.resize(m_table.size());
+
+    for (size_t i = 0; i < m_table.size(); i++)
+        m_fieldsOfId[m_table[i].reportId].push_back(i);
+}
+
+void ReportAggregator::add(const unsigned char *report, size_t length, uint64_t time)
+{
+    if (!length)
+        return;
+    if (m_current < 0)
+        m_origin = time;
+
+    int64_t k = time > m_origin ? int64_t((time - m_origin) / m_hopNs) : 0;
+    if (k < m_current)
+        k = m_current;
+    if (k > m_current) {
+        /* Windows ending more than a window after the last report are empty */
+        int64_t last = m_current < 0 ? k : std::min<int64_t>(k, m_current + int64_t(m_panes.size()));
+        for (int64_t j = std::max<int64_t>(m_current, 0); j < last; j++)
+            emit(j);
+        m_current = k;
+
+        Pane &p = m_panes[k % m_panes.size()];
+        p.index = k;
+        p.count = 0;
+        std::fill(p.fields.begin(), p.fields.end(), FieldAggregate());
+    }
+
+    Pane &p = m_panes[k % m_panes.size()];
+    p.count++;
+    for (size_t i : m_fieldsOfId[report[0]]) {
+        const ReportField &field = m_table[i];
+        if (field.bitOffset + field.bitSize > length * 8)
+            continue;
+        int64_t v = field.value(report, length);
+        FieldAggregate &a = p.fields[i];
+        if (!a.count || v < a.min)
+            a.min = v;
+        if (!a.count || v > a.max)
+            a.max = v;
+        a.sum += v;
+        a.last = v;
+        a.count++;
+    }
+}
+
+void ReportAggregator::flush()
+{
+    if (m_current < 0)
+        return;
+    emit(m_current);
+    for (auto &p : m_panes)
+        p.index = -1;
+    m_current = -1;
+}
+
+void ReportAggregator::emit(int64_t last)
+{
+    int64_t first = last - int64_t(m_panes.size()) + 1;
+    m_out.count = 0;
+    std::fill(m_out.fields.begin(), m_out.fields.end(), FieldAggregate());
+
+    /* Oldest pane first, so that later panes overwrite last */
+    for (int64_t j = std::max<int64_t>(first, 0); j <= last; j++) {
+        const Pane &p = m_panes[j % m_panes.size()];
+        if (p.index != j || !p.count)
+            continue;
+        m_out.count += p.count;
+        for (size_t i = 0; i < p.fields.size(); i++) {
+            const FieldAggregate &a = p.fields[i];
+            if (!a.count)
+                continue;
+            FieldAggregate &o = m_out.fields[i];
+            if (!o.count || a.min < o.min)
+                o.min = a.min;
+            if (!o.count || a.max > o.max)
+                o.max = a.max;
+            o.sum += a.sum;
+            o.last = a.last;
+            o.count += a.count;
+        }
+    }
+    if (!m_out.count || !m_callback)
+        return;
+
+    m_out.start = m_origin + uint64_t(std::max<int64_t>(first, 0)) * m_hopNs;
+    m_out.end = m_origin + uint64_t(last + 1) * m_hopNs;
+    m_callback(m_out);
+}
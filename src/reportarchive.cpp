@@ -0,0 +1,593 @@
+#include "reportarchive.h"
+
+#include <algorithm>
+#include <cstring>
+
+/* File layout: ARCHIVE_MAGIC, then records starting with a 32-bit tag.
+ * Device records register a name, block records hold the reports of one
+ * stream, and the index record written by close() lists devices and blocks.
+ * The file ends with the offset of the index record and ARCHIVE_TAG_END.
+ * All integers are little endian. */
+#define ARCHIVE_MAGIC       "YAHAARC\x01"
+#define ARCHIVE_MAGIC_SIZE  8
+#define ARCHIVE_TAG_DEVICE  0x43564544  /* "DEVC" */
+#define ARCHIVE_TAG_BLOCK   0x4b434c42  /* "BLCK" */
+#define ARCHIVE_TAG_INDEX   0x58444e49  /* "INDX" */
+#define ARCHIVE_TAG_END     0x444e4559  /* "YEND" */
+#define ARCHIVE_TRAILER_SIZE 12
+/* Tag, device, report ID, count, width, two times and three column sizes */
+#define ARCHIVE_BLOCK_HEADER_SIZE (4 + 4 + 1 + 4 + 4 + 8 + 8 + 4 + 4 + 4)
+
+static void put8(std::vector<unsigned char> &b, unsigned char v)
+{
+    b.push_back(v);
+}
+
+static void put32(std::vector<unsigned char> &b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static void put64(std::vector<unsigned char> &b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        b.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static void putVarint(std::vector<unsigned char> &b, uint64_t v)
+{
+    while (v >= 0x80) {
+        b.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    b.push_back((unsigned char)v);
+}
+
+static void putName(std::vector<unsigned char> &b, const std::wstring &name)
+{
+    put32(b, uint32_t(name.size()));
+    for (wchar_t c : name) {
+        b.push_back((unsigned char)c);
+        b.push_back((unsigned char)(c >> 8));
+    }
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+/* Bounds-checked reader over a byte buffer */
+struct ArchiveCursor
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    bool ok = true;
+
+    ArchiveCursor(const unsigned char *data, size_t size) : p(data), end(data + size) {}
+
+    bool need(size_t n)
+    {
+        if (size_t(end - p) < n)
+            ok = false;
+        return ok;
+    }
+    unsigned char get8()
+    {
+        return need(1) ? *p++ : 0;
+    }
+    uint32_t get32()
+    {
+        uint32_t v = 0;
+        if (need(4))
+            for (int i = 0; i < 4; i++)
+                v |= uint32_t(*p++) << (8 * i);
+        return v;
+    }
+    uint64_t get64()
+    {
+        uint64_t v = 0;
+        if (need(8))
+            for (int i = 0; i < 8; i++)
+                v |= uint64_t(*p++) << (8 * i);
+        return v;
+    }
+    uint64_t getVarint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64 && need(1); shift += 7) {
+            unsigned char c = *p++;
+            v |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return v;
+        }
+        ok = false;
+        return 0;
+    }
+    std::wstring getName()
+    {
+        uint32_t n = get32();
+        std::wstring name;
+        if (!need(size_t(n) * 2))
+            return name;
+        for (uint32_t i = 0; i < n; i++, p += 2)
+            name.push_back(wchar_t(p[0] | (p[1] << 8)));
+        return name;
+    }
+};
+
+/* Run-length coder for zero bytes: pairs of zero run and literal run
+ * lengths, each followed by the literal bytes */
+static void compress(const std::vector<unsigned char> &in, std::vector<unsigned char> &out)
+{
+    size_t n = in.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t zeros = 0;
+        while (i + zeros < n && !in[i + zeros])
+            zeros++;
+        i += zeros;
+
+        /* Single zeros are cheaper as literals */
+        size_t literals = 0;
+        while (i + literals < n && (in[i + literals] || (i + literals + 1 < n && in[i + literals + 1])))
+            literals++;
+
+        putVarint(out, zeros);
+        putVarint(out, literals);
+        out.insert(out.end(), in.begin() + i, in.begin() + i + literals);
+        i += literals;
+    }
+}
+
+/* Fails if the output would grow beyond limit bytes */
+static bool decompress(const unsigned char *in, size_t size, std::vector<unsigned char> &out, size_t limit)
+{
+    out.clear();
+    ArchiveCursor c(in, size);
+    while (c.ok && c.p < c.end) {
+        uint64_t zeros = c.getVarint();
+        uint64_t literals = c.getVarint();
+        if (!c.ok || zeros > limit - out.size() || literals > limit - out.size() - zeros || !c.need(literals))
+            return false;
+        out.insert(out.end(), size_t(zeros), 0);
+        out.insert(out.end(), c.p, c.p + literals);
+        c.p += literals;
+    }
+    return c.ok;
+}
+
+static bool seekTo(std::FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t fileSize(std::FILE *f)
+{
+    if (std::fseek(f, 0, SEEK_END) != 0)
+        return 0;
+#ifdef _WIN32
+    return uint64_t(_ftelli64(f));
+#else
+    return uint64_t(ftello(f));
+#endif
+}
+
+static bool readAt(std::FILE *f, uint64_t offset, size_t size, std::vector<unsigned char> &buf)
+{
+    buf.resize(size);
+    return seekTo(f, offset) && std::fread(buf.data(), 1, size, f) == size;
+}
+
+ReportArchiveWriter::ReportArchiveWriter(size_t blockReports) :
+    m_blockReports(std::max<size_t>(blockReports, 1))
+{
+}
+
+ReportArchiveWriter::~ReportArchiveWriter()
+{
+    close();
+}
+
+bool ReportArchiveWriter::open(const std::string &path)
+{
+    close();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file)
+        return false;
+
+    m_offset = 0;
+    m_devices.clear();
+    m_streams.clear();
+    m_index.clear();
+    m_rawBytes = 0;
+    m_failed = false;
+    return put(std::vector<unsigned char>(ARCHIVE_MAGIC, ARCHIVE_MAGIC + ARCHIVE_MAGIC_SIZE));
+}
+
+bool ReportArchiveWriter::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file)
+        return true;
+
+    for (auto &s : m_streams)
+        flush(uint32_t(s.first >> 8), (unsigned char)s.first, s.second);
+
+    std::vector<std::wstring> names(m_devices.size());
+    for (auto &d : m_devices)
+        names[d.second] = d.first;
+
+    std::vector<unsigned char> b;
+    uint64_t indexOffset = m_offset;
+    put32(b, ARCHIVE_TAG_INDEX);
+    put32(b, uint32_t(names.size()));
+    for (auto &n : names)
+        putName(b, n);
+    put32(b, uint32_t(m_index.size()));
+    for (auto &e : m_index) {
+        put32(b, e.device);
+        put8(b, e.reportId);
+        put32(b, e.count);
+        put64(b, e.firstTime);
+        put64(b, e.lastTime);
+        put64(b, e.offset);
+    }
+    put64(b, indexOffset);
+    put32(b, ARCHIVE_TAG_END);
+    put(b);
+
+    bool ok = !m_failed && std::fclose(m_file) == 0;
+    m_file = nullptr;
+    return ok;
+}
+
+uint32_t ReportArchiveWriter::device(const std::wstring &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_devices.find(name);
+    if (it != m_devices.end())
+        return it->second;
+
+    uint32_t id = uint32_t(m_devices.size());
+    m_devices[name] = id;
+    if (m_file) {
+        std::vector<unsigned char> b;
+        put32(b, ARCHIVE_TAG_DEVICE);
+        put32(b, id);
+        putName(b, name);
+        put(b);
+    }
+    return id;
+}
+
+bool ReportArchiveWriter::append(uint32_t device, const unsigned char *report, size_t length, uint64_t time)
+{
+    if (!length)
+        return true;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file || m_failed)
+        return false;
+
+    Stream &s = m_streams[(uint64_t(device) << 8) | report[0]];
+    s.times.push_back(time);
+    s.lengths.push_back(uint32_t(length));
+    s.data.insert(s.data.end(), report, report + length);
+    m_rawBytes += length;
+
+    if (s.times.size() >= m_blockReports)
+        return flush(device, report[0], s);
+    return true;
+}
+
+bool ReportArchiveWriter::flush(uint32_t device, unsigned char reportId, Stream &s)
+{
+    size_t count = s.times.size();
+    if (!count)
+        return true;
+
+    std::vector<unsigned char> raw, times, lengths, payload;
+    for (size_t i = 1; i < count; i++)
+        putVarint(raw, zigzag(int64_t(s.times[i] - s.times[i - 1])));
+    compress(raw, times);
+
+    raw.clear();
+    uint32_t width = 0;
+    for (size_t i = 0; i < count; i++) {
+        putVarint(raw, zigzag(int64_t(s.lengths[i]) - (i ? int64_t(s.lengths[i - 1]) : 0)));
+        width = std::max(width, s.lengths[i]);
+    }
+    compress(raw, lengths);
+
+    /* XOR every report with the previous one, then store byte 0 of all
+     * reports, byte 1 of all reports and so on */
+    raw.assign(size_t(width) * count, 0);
+    std::vector<unsigned char> prev(width, 0), cur(width);
+    const unsigned char *r = s.data.data();
+    for (size_t i = 0; i < count; i++) {
+        std::fill(cur.begin(), cur.end(), 0);
+        memcpy(cur.data(), r, s.lengths[i]);
+        r += s.lengths[i];
+        for (uint32_t j = 0; j < width; j++)
+            raw[j * count + i] = cur[j] ^ prev[j];
+        prev.swap(cur);
+    }
+    compress(raw, payload);
+
+    ArchiveBlockInfo info;
+    info.device = device;
+    info.reportId = reportId;
+    info.count = uint32_t(count);
+    /* The header keeps the first time as base of the deltas, the index the
+     * smallest, as time stamps of merged streams need not be in order */
+    info.firstTime = *std::min_element(s.times.begin(), s.times.end());
+    info.lastTime = *std::max_element(s.times.begin(), s.times.end());
+    info.offset = m_offset;
+
+    std::vector<unsigned char> b;
+    put32(b, ARCHIVE_TAG_BLOCK);
+    put32(b, device);
+    put8(b, reportId);
+    put32(b, info.count);
+    put32(b, width);
+    put64(b, s.times.front());
+    put64(b, info.lastTime);
+    put32(b, uint32_t(times.size()));
+    put32(b, uint32_t(lengths.size()));
+    put32(b, uint32_t(payload.size()));
+    b.insert(b.end(), times.begin(), times.end());
+    b.insert(b.end(), lengths.begin(), lengths.end());
+    b.insert(b.end(), payload.begin(), payload.end());
+
+    s.times.clear();
+    s.lengths.clear();
+    s.data.clear();
+    m_index.push_back(info);
+    return put(b);
+}
+
+bool ReportArchiveWriter::put(const std::vector<unsigned char> &bytes)
+{
+    if (std::fwrite(bytes.data(), 1, bytes.size(), m_file) != bytes.size())
+        m_failed = true;
+    m_offset += bytes.size();
+    return !m_failed;
+}
+
+ReportArchiveReader::~ReportArchiveReader()
+{
+    close();
+}
+
+bool ReportArchiveReader::open(const std::string &path)
+{
+    close();
+    m_file = std::fopen(path.c_str(), "rb");
+    if (!m_file)
+        return false;
+
+    std::vector<unsigned char> b;
+    if (!readAt(m_file, 0, ARCHIVE_MAGIC_SIZE, b) || memcmp(b.data(), ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE)) {
+        close();
+        return false;
+    }
+
+    /* Find the trailer, fall back to scanning if there is none */
+    b.resize(ARCHIVE_TRAILER_SIZE);
+    if (!seekTo(m_file, 0) || std::fseek(m_file, -ARCHIVE_TRAILER_SIZE, SEEK_END) != 0
+            || std::fread(b.data(), 1, ARCHIVE_TRAILER_SIZE, m_file) != ARCHIVE_TRAILER_SIZE)
+        return scan();
+    ArchiveCursor t(b.data(), ARCHIVE_TRAILER_SIZE);
+    uint64_t indexOffset = t.get64();
+    if (t.get32() != ARCHIVE_TAG_END)
+        return scan();
+
+    uint64_t size = fileSize(m_file);
+    if (indexOffset < ARCHIVE_MAGIC_SIZE || indexOffset + ARCHIVE_TRAILER_SIZE > size)
+        return scan();
+    if (!readAt(m_file, indexOffset, size_t(size - indexOffset - ARCHIVE_TRAILER_SIZE), b))
+        return scan();
+
+    ArchiveCursor c(b.data(), b.size());
+    if (c.get32() != ARCHIVE_TAG_INDEX)
+        return scan();
+    uint32_t devices = c.get32();
+    for (uint32_t i = 0; i < devices && c.ok; i++)
+        m_devices.push_back(c.getName());
+    uint32_t blocks = c.get32();
+    for (uint32_t i = 0; i < blocks && c.ok; i++) {
+        ArchiveBlockInfo e;
+        e.device = c.get32();
+        e.reportId = c.get8();
+        e.count = c.get32();
+        e.firstTime = c.get64();
+        e.lastTime = c.get64();
+        e.offset = c.get64();
+        m_blocks.push_back(e);
+    }
+    if (!c.ok) {
+        m_devices.clear();
+        m_blocks.clear();
+        return scan();
+    }
+    return true;
+}
+
+void ReportArchiveReader::close()
+{
+    if (m_file)
+        std::fclose(m_file);
+    m_file = nullptr;
+    m_devices.clear();
+    m_blocks.clear();
+}
+
+bool ReportArchiveReader::scan()
+{
+    uint64_t end = fileSize(m_file);
+    uint64_t offset = ARCHIVE_MAGIC_SIZE;
+    std::vector<unsigned char> b;
+    std::vector<uint64_t> times;
+    std::vector<uint32_t> lengths;
+    std::vector<unsigned char> data;
+    while (readAt(m_file, offset, 4, b)) {
+        uint32_t tag = ArchiveCursor(b.data(), 4).get32();
+        if (tag == ARCHIVE_TAG_DEVICE) {
+            if (!readAt(m_file, offset, 12, b))
+                break;
+            ArchiveCursor h(b.data(), b.size());
+            h.get32();
+            uint32_t id = h.get32();
+            uint32_t chars = h.get32();
+            if (!readAt(m_file, offset + 4, 8 + size_t(chars) * 2, b))
+                break;
+            ArchiveCursor c(b.data(), b.size());
+            c.get32();
+            if (id >= m_devices.size())
+                m_devices.resize(id + 1);
+            m_devices[id] = c.getName();
+            offset += 12 + uint64_t(chars) * 2;
+        } else if (tag == ARCHIVE_TAG_BLOCK) {
+            if (!readAt(m_file, offset, ARCHIVE_BLOCK_HEADER_SIZE, b))
+                break;
+            ArchiveCursor c(b.data(), b.size());
+            c.get32();
+            ArchiveBlockInfo e;
+            e.device = c.get32();
+            e.reportId = c.get8();
+            e.count = c.get32();
+            c.get32();
+            e.firstTime = c.get64();
+            e.lastTime = c.get64();
+            e.offset = offset;
+            uint64_t size = uint64_t(c.get32()) + c.get32() + c.get32();
+            if (offset + ARCHIVE_BLOCK_HEADER_SIZE + size > end)
+                break;
+            /* The header holds the first time, not the smallest the index needs */
+            if (!decode(offset, times, lengths, data))
+                break;
+            e.firstTime = *std::min_element(times.begin(), times.end());
+            m_blocks.push_back(e);
+            offset += ARCHIVE_BLOCK_HEADER_SIZE + size;
+        } else {
+            /* Index record or a block cut short by a crash */
+            break;
+        }
+    }
+    return true;
+}
+
+bool ReportArchiveReader::decode(uint64_t offset, std::vector<uint64_t> &times,
+                                 std::vector<uint32_t> &lengths, std::vector<unsigned char> &data)
+{
+    std::vector<unsigned char> b;
+    if (!readAt(m_file, offset, ARCHIVE_BLOCK_HEADER_SIZE, b))
+        return false;
+    ArchiveCursor h(b.data(), b.size());
+    if (h.get32() != ARCHIVE_TAG_BLOCK)
+        return false;
+    h.get32();
+    h.get8();
+    uint32_t count = h.get32();
+    uint32_t width = h.get32();
+    uint64_t first = h.get64();
+    h.get64();
+    uint32_t timesSize = h.get32();
+    uint32_t lengthsSize = h.get32();
+    uint32_t payloadSize = h.get32();
+    if (!count)
+        return false;
+
+    if (!readAt(m_file, offset + ARCHIVE_BLOCK_HEADER_SIZE, size_t(timesSize) + lengthsSize + payloadSize, b))
+        return false;
+
+    /* A varint takes at most 10 bytes */
+    std::vector<unsigned char> raw;
+    if (!decompress(b.data(), timesSize, raw, size_t(count) * 10))
+        return false;
+    ArchiveCursor t(raw.data(), raw.size());
+    times.assign(1, first);
+    for (uint32_t i = 1; i < count && t.ok; i++)
+        times.push_back(times.back() + uint64_t(unzigzag(t.getVarint())));
+    if (!t.ok)
+        return false;
+
+    if (!decompress(b.data() + timesSize, lengthsSize, raw, size_t(count) * 10))
+        return false;
+    ArchiveCursor l(raw.data(), raw.size());
+    lengths.clear();
+    int64_t length = 0;
+    for (uint32_t i = 0; i < count && l.ok; i++) {
+        length += unzigzag(l.getVarint());
+        if (length < 0 || length > int64_t(width))
+            return false;
+        lengths.push_back(uint32_t(length));
+    }
+    if (!l.ok)
+        return false;
+
+    size_t expected = size_t(width) * count;
+    if (!decompress(b.data() + timesSize + lengthsSize, payloadSize, raw, expected) || raw.size() != expected)
+        return false;
+
+    /* Undo the transposition and XOR chain */
+    data.clear();
+    std::vector<unsigned char> prev(width, 0);
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t j = 0; j < width; j++)
+            prev[j] ^= raw[size_t(j) * count + i];
+        data.insert(data.end(), prev.begin(), prev.begin() + lengths[i]);
+    }
+    return true;
+}
+
+bool ReportArchiveReader::read(uint32_t device, uint64_t from, uint64_t to, Visitor visit)
+{
+    struct Record
+    {
+        uint64_t time;
+        size_t offset;
+        uint32_t length;
+    };
+    std::vector<Record> records;
+    std::vector<unsigned char> all;
+
+    std::vector<uint64_t> times;
+    std::vector<uint32_t> lengths;
+    std::vector<unsigned char> data;
+    for (const ArchiveBlockInfo &e : m_blocks) {
+        if (e.device != device || e.lastTime < from || e.firstTime > to)
+            continue;
+        if (!decode(e.offset, times, lengths, data))
+            return false;
+
+        size_t pos = 0;
+        for (size_t i = 0; i < times.size(); i++) {
+            if (times[i] >= from && times[i] <= to) {
+                records.push_back(Record{times[i], all.size(), lengths[i]});
+                all.insert(all.end(), data.begin() + pos, data.begin() + pos + lengths[i]);
+            }
+            pos += lengths[i];
+        }
+    }
+
+    /* Blocks of different report IDs overlap in time */
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record &a, const Record &b){return a.time < b.time;});
+    for (const Record &r : records)
+        if (!visit(r.time, all.data() + r.offset, r.length))
+            break;
+    return true;
+}
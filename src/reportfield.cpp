@@ -0,0 +1,147 @@
+#include "reportfield.h"
+
+#include <map>
+
+/* Item types and tags of the HID 1.11 specification, section 6.2.2 */
+#define ITEM_MAIN   0
+#define ITEM_GLOBAL 1
+#define ITEM_LOCAL  2
+
+#define MAIN_INPUT          0x8
+#define GLOBAL_USAGE_PAGE   0x0
+#define GLOBAL_LOGICAL_MIN  0x1
+#define GLOBAL_REPORT_SIZE  0x7
+#define GLOBAL_REPORT_ID    0x8
+#define GLOBAL_REPORT_COUNT 0x9
+#define GLOBAL_PUSH         0xA
+#define GLOBAL_POP          0xB
+#define LOCAL_USAGE         0x0
+#define LOCAL_USAGE_MIN     0x1
+#define LOCAL_USAGE_MAX     0x2
+
+#define INPUT_CONSTANT 0x1
+#define INPUT_VARIABLE 0x2
+
+/* Windows reports report lengths as USHORT */
+#define MAX_REPORT_BITS (0xffffu * 8)
+
+/* Global items in effect, saved and restored by Push and Pop */
+struct DescriptorGlobals
+{
+    unsigned short usagePage = 0;
+    int32_t logicalMin = 0;
+    unsigned int reportSize = 0;
+    unsigned int reportCount = 0;
+    unsigned char reportId = 0;
+};
+
+bool ReportFieldTable::parse(const unsigned char *descriptor, size_t length)
+{
+    DescriptorGlobals global;
+    std::vector<DescriptorGlobals> stack;
+    /* Usages are stored with their page in the upper 16 bits */
+    std::vector<uint32_t> usages;
+    uint32_t usageMin = 0;
+    uint32_t usageMax = 0;
+    bool haveRange = false;
+    /* Next input bit per report ID, after the report ID byte */
+    std::map<unsigned char, unsigned int> offsets;
+
+    size_t i = 0;
+    while (i < length) {
+        unsigned char prefix = descriptor[i++];
+
+        /* Long items carry no information for us */
+        if (prefix == 0xFE) {
+            if (i + 1 >= length)
+                return false;
+            i += 2 + descriptor[i];
+            continue;
+        }
+
+        unsigned int size = prefix & 0x3;
+        if (size == 3)
+            size = 4;
+        unsigned int type = (prefix >> 2) & 0x3;
+        unsigned int tag = prefix >> 4;
+        if (i + size > length)
+            return false;
+
+        uint32_t data = 0;
+        for (unsigned int b = 0; b < size; b++)
+            data |= uint32_t(descriptor[i + b]) << (8 * b);
+        int32_t sdata = int32_t(data);
+        if (size == 1)
+            sdata = int8_t(data);
+        else if (size == 2)
+            sdata = int16_t(data);
+        i += size;
+
+        if (type == ITEM_GLOBAL) {
+            switch (tag) {
+            case GLOBAL_USAGE_PAGE:   global.usagePage = (unsigned short)data; break;
+            case GLOBAL_LOGICAL_MIN:  global.logicalMin = sdata; break;
+            case GLOBAL_REPORT_SIZE:  global.reportSize = data; break;
+            case GLOBAL_REPORT_ID:    global.reportId = (unsigned char)data; break;
+            case GLOBAL_REPORT_COUNT: global.reportCount = data; break;
+            case GLOBAL_PUSH:         stack.push_back(global); break;
+            case GLOBAL_POP:
+                if (stack.empty())
+                    return false;
+                global = stack.back();
+                stack.pop_back();
+                break;
+            }
+        } else if (type == ITEM_LOCAL) {
+            /* Without a page in the upper bits the current usage page applies */
+            uint32_t usage = size == 4 ? data : (uint32_t(global.usagePage) << 16) | data;
+            switch (tag) {
+            case LOCAL_USAGE:     usages.push_back(usage); break;
+            case LOCAL_USAGE_MIN: usageMin = usage; haveRange = true; break;
+            case LOCAL_USAGE_MAX: usageMax = usage; haveRange = true; break;
+            }
+        } else if (type == ITEM_MAIN) {
+            if (tag == MAIN_INPUT) {
+                unsigned int &offset = offsets.emplace(global.reportId, 8).first->second;
+                bool variable = (data & INPUT_VARIABLE) && !(data & INPUT_CONSTANT);
+                /* A bogus Report Count or Size would allocate billions of fields */
+                if (offset + uint64_t(global.reportCount) * global.reportSize > MAX_REPORT_BITS)
+                    return false;
+
+                for (unsigned int n = 0; n < global.reportCount; n++) {
+                    if (variable && global.reportSize >= 1 && global.reportSize <= 32) {
+                        uint32_t usage = 0;
+                        if (n < usages.size())
+                            usage = usages[n];
+                        else if (haveRange && usageMin + n <= usageMax)
+                            usage = usageMin + n;
+                        else if (!usages.empty())
+                            usage = usages.back();
+
+                        ReportField f;
+                        f.reportId = global.reportId;
+                        f.usagePage = (unsigned short)(usage >> 16);
+                        f.usage = (unsigned short)usage;
+                        f.bitOffset = offset;
+                        f.bitSize = global.reportSize;
+                        f.isSigned = global.logicalMin < 0;
+                        m_fields.push_back(f);
+                    }
+                    offset += global.reportSize;
+                }
+            }
+            /* Local items only apply to the next main item */
+            usages.clear();
+            haveRange = false;
+        }
+    }
+    return true;
+}
+
+int ReportFieldTable::find(unsigned short usagePage, unsigned short usage) const
+{
+    for (size_t i = 0; i < m_fields.size(); i++)
+        if (m_fields[i].usagePage == usagePage && m_fields[i].usage == usage)
+            return int(i);
+    return -1;
+}
@@ -0,0 +1,158 @@
+#include "reportformatter.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REPORTFORMATTER_SSE2
+#endif
+
+/* Two hex digits per byte value */
+struct HexTable
+{
+    char digits[256][2];
+    char printable[256];
+
+    HexTable()
+    {
+        const char *h = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            digits[i][0] = h[i >> 4];
+            digits[i][1] = h[i & 0xf];
+            printable[i] = (i >= 0x20 && i < 0x7f) ? char(i) : '.';
+        }
+    }
+};
+
+static const HexTable s_table;
+
+#ifdef REPORTFORMATTER_SSE2
+/* 16 bytes to 32 hex digits: split into nibbles, map 0-9 and a-f with a
+ * compare, then interleave high and low nibbles */
+static void hex16(const unsigned char *in, char *out)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i v = _mm_loadu_si128((const __m128i*)in);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+    _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi8(hi, lo));
+}
+#endif
+
+size_t ReportFormatter::hex(const unsigned char *report, size_t length, char *out, char separator)
+{
+    char *p = out;
+    size_t i = 0;
+    if (!separator) {
+#ifdef REPORTFORMATTER_SSE2
+        for (; i + 16 <= length; i += 16, p += 32)
+            hex16(report + i, p);
+#endif
+        for (; i < length; i++, p += 2)
+            memcpy(p, s_table.digits[report[i]], 2);
+        return size_t(p - out);
+    }
+
+    for (; i < length; i++) {
+        memcpy(p, s_table.digits[report[i]], 2);
+        p[2] = separator;
+        p += 3;
+    }
+    return size_t(p - out);
+}
+
+size_t ReportFormatter::ascii(const unsigned char *report, size_t length, char *out)
+{
+    for (size_t i = 0; i < length; i++)
+        out[i] = s_table.printable[report[i]];
+    return length;
+}
+
+size_t ReportFormatter::decimal(int64_t value, char *out)
+{
+    char tmp[20];
+    size_t n = 0;
+    uint64_t v = value < 0 ? 0 - uint64_t(value) : uint64_t(value);
+    do {
+        tmp[n++] = char('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    size_t len = 0;
+    if (value < 0)
+        out[len++] = '-';
+    while (n)
+        out[len++] = tmp[--n];
+    return len;
+}
+
+/* "0000:0000=" plus a 64-bit value and a space per field */
+#define FIELD_TEXT_SIZE 32
+/* Time stamp, IDs, separators and newline */
+#define LINE_FIXED_SIZE 48
+
+size_t ReportFormatter::lineSize(size_t length, const ReportFieldTable *fields)
+{
+    return LINE_FIXED_SIZE + hexSize(length) + length + (fields ? fields->size() * FIELD_TEXT_SIZE : 0);
+}
+
+size_t ReportFormatter::line(uint64_t time, unsigned short vid, unsigned short pid,
+                             const unsigned char *report, size_t length, int format,
+                             const ReportFieldTable *fields, char *out)
+{
+    char *p = out;
+
+    /* Seconds with microseconds, zero padded */
+    p += decimal(int64_t(time / 1000000000), p);
+    *p++ = '.';
+    uint64_t us = (time / 1000) % 1000000;
+    for (int d = 5; d >= 0; d--) {
+        p[d] = char('0' + us % 10);
+        us /= 10;
+    }
+    p += 6;
+
+    unsigned char ids[4] = {(unsigned char)(vid >> 8), (unsigned char)vid, (unsigned char)(pid >> 8), (unsigned char)pid};
+    *p++ = ' ';
+    p += hex(ids, 2, p, 0);
+    *p++ = ':';
+    p += hex(ids + 2, 2, p, 0);
+    *p++ = ' ';
+
+    if (format & FormatHex)
+        p += hex(report, length, p);
+    if (format & FormatAscii) {
+        *p++ = '|';
+        p += ascii(report, length, p);
+        *p++ = '|';
+        *p++ = ' ';
+    }
+    if ((format & FormatFields) && fields) {
+        for (size_t i = 0; i < fields->size(); i++) {
+            const ReportField &f = (*fields)[i];
+            if (!length || report[0] != f.reportId)
+                continue;
+            unsigned char usage[4] = {(unsigned char)(f.usagePage >> 8), (unsigned char)f.usagePage,
+                                      (unsigned char)(f.usage >> 8), (unsigned char)f.usage};
+            p += hex(usage, 2, p, 0);
+            *p++ = ':';
+            p += hex(usage + 2, 2, p, 0);
+            *p++ = '=';
+            p += decimal(f.value(report, length), p);
+            *p++ = ' ';
+        }
+    }
+
+    /* Replace the trailing space */
+    if (p > out && p[-1] == ' ')
+        p--;
+    *p++ = '\n';
+    return size_t(p - out);
+}
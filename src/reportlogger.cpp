@@ -0,0 +1,119 @@
+#include "reportlogger.h"
+#include "hiddevice.h"
+
+#include <algorithm>
+#include <chrono>
+
+ReportLogger::ReportLogger(size_t bufferSize, unsigned int buffers) :
+    m_bufferSize(std::max<size_t>(bufferSize, 4096))
+{
+    for (unsigned int i = 0; i < std::max(buffers, 2u); i++) {
+        std::unique_ptr<Buffer> b(new Buffer());
+        b->data.resize(m_bufferSize);
+        m_free.push_back(std::move(b));
+    }
+    m_current = std::move(m_free.back());
+    m_free.pop_back();
+}
+
+ReportLogger::~ReportLogger()
+{
+    close();
+}
+
+bool ReportLogger::open(const std::string &path)
+{
+    close();
+    m_file = std::fopen(path.c_str(), "ab");
+    if (!m_file)
+        return false;
+    /* Buffers are written whole, stdio buffering would only add a copy */
+    std::setvbuf(m_file, nullptr, _IONBF, 0);
+
+    m_stop = false;
+    m_writer = std::thread([this](){this->run();});
+    return true;
+}
+
+void ReportLogger::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_full.notify_all();
+    if (m_writer.joinable())
+        m_writer.join();
+    if (m_file) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool ReportLogger::rotate()
+{
+    if (m_free.empty())
+        return false;
+    m_pending.push_back(std::move(m_current));
+    m_current = std::move(m_free.back());
+    m_free.pop_back();
+    m_full.notify_one();
+    return true;
+}
+
+void ReportLogger::log(HidDevice *device, const unsigned char *report, size_t length, uint64_t time)
+{
+    size_t need = ReportFormatter::lineSize(length, &m_fields);
+    if (need > m_bufferSize) {
+        m_dropped++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file || m_stop) {
+        m_dropped++;
+        return;
+    }
+    if (m_current->used + need > m_bufferSize && !rotate()) {
+        m_dropped++;
+        return;
+    }
+
+    Buffer &b = *m_current;
+    b.used += ReportFormatter::line(time, device ? device->getVid() : 0, device ? device->getPid() : 0,
+                                    report, length, m_format, &m_fields, b.data.data() + b.used);
+    m_lines++;
+}
+
+void ReportLogger::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        /* A partly filled buffer is written after the flush interval, so a
+         * quiet device still shows up in the file */
+        if (m_pending.empty() && !m_stop)
+            m_full.wait_for(lock, std::chrono::milliseconds(m_flushMs),
+                            [this](){return !m_pending.empty() || m_stop;});
+        if (m_pending.empty() && m_current->used && !m_free.empty())
+            rotate();
+        if (m_pending.empty()) {
+            if (m_stop)
+                break;
+            continue;
+        }
+
+        std::vector<std::unique_ptr<Buffer>> pending;
+        pending.swap(m_pending);
+        lock.unlock();
+
+        for (auto &b : pending) {
+            size_t n = std::fwrite(b->data.data(), 1, b->used, m_file);
+            m_written += n;
+            b->used = 0;
+        }
+
+        lock.lock();
+        for (auto &b : pending)
+            m_free.push_back(std::move(b));
+    }
+}
@@ -0,0 +1,226 @@
+#include "reportpredicate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#define OP_EQUAL        0
+#define OP_NOT_EQUAL    1
+#define OP_RANGE        2
+
+//! Bytes merged into one compare
+#define WORD_BYTES      8
+
+/* Little endian load of size bytes, at most WORD_BYTES */
+static inline uint64_t load(const unsigned char *report, size_t length, size_t offset, size_t size)
+{
+    uint64_t v = 0;
+    if (offset + WORD_BYTES <= length) {
+        /* Windows only runs little endian, the mask drops the extra bytes */
+        memcpy(&v, report + offset, WORD_BYTES);
+        return v;
+    }
+    for (size_t i = 0; i < size; i++)
+        v |= uint64_t(report[offset + i]) << (8 * i);
+    return v;
+}
+
+ReportPredicate &ReportPredicate::byte(size_t offset, unsigned char mask, unsigned char value)
+{
+    Term t = Term();
+    t.op = OP_EQUAL;
+    t.clause = m_clause;
+    t.offset = offset;
+    t.mask = mask;
+    t.value = value & mask;
+    m_terms.push_back(t);
+    compile();
+    return *this;
+}
+
+ReportPredicate &ReportPredicate::byteNot(size_t offset, unsigned char mask, unsigned char value)
+{
+    Term t = Term();
+    t.op = OP_NOT_EQUAL;
+    t.clause = m_clause;
+    t.offset = offset;
+    t.mask = mask;
+    t.value = value & mask;
+    m_terms.push_back(t);
+    compile();
+    return *this;
+}
+
+ReportPredicate &ReportPredicate::range(const ReportField &field, int64_t min, int64_t max)
+{
+    Term t = Term();
+    t.op = OP_RANGE;
+    t.clause = m_clause;
+    t.field = field;
+    t.min = min;
+    t.max = max;
+    m_terms.push_back(t);
+    compile();
+    return *this;
+}
+
+ReportPredicate &ReportPredicate::orElse()
+{
+    /* Consecutive calls do not create empty alternatives, which would match everything */
+    if (!m_terms.empty() && m_terms.back().clause == m_clause)
+        m_clause++;
+    return *this;
+}
+
+void ReportPredicate::clear()
+{
+    m_terms.clear();
+    m_clause = 0;
+    compile();
+}
+
+void ReportPredicate::compile()
+{
+    m_program.clear();
+    m_matchAll = m_terms.empty();
+
+    for (size_t i = 0; i < m_terms.size();) {
+        std::vector<const Term*> clause;
+        unsigned int c = m_terms[i].clause;
+        while (i < m_terms.size() && m_terms[i].clause == c)
+            clause.push_back(&m_terms[i++]);
+
+        std::vector<Instr> code;
+        if (!compileClause(clause, code))
+            continue;
+        if (code.empty()) {
+            /* An alternative without conditions makes the rest irrelevant */
+            m_program.clear();
+            m_matchAll = true;
+            return;
+        }
+
+        uint32_t next = uint32_t(m_program.size() + code.size());
+        for (Instr &in : code)
+            in.next = next;
+        code.back().last = true;
+        m_program.insert(m_program.end(), code.begin(), code.end());
+    }
+}
+
+bool ReportPredicate::compileClause(const std::vector<const Term*> &terms, std::vector<Instr> &out) const
+{
+    /* Required bits per byte: mask and value */
+    std::map<size_t, std::pair<unsigned char, unsigned char>> equal;
+    std::vector<Instr> rest;
+
+    auto require = [&equal](size_t offset, unsigned char mask, unsigned char value) {
+        std::pair<unsigned char, unsigned char> &e = equal[offset];
+        if ((e.first & mask) & (e.second ^ value))
+            return false;
+        e.first |= mask;
+        e.second |= value;
+        return true;
+    };
+
+    for (const Term *t : terms) {
+        Instr in = Instr();
+        in.op = t->op;
+        switch (t->op) {
+        case OP_EQUAL:
+            if (!require(t->offset, t->mask, t->value))
+                return false;
+            break;
+        case OP_NOT_EQUAL:
+            if (!t->mask)
+                return false;
+            in.size = 1;
+            in.offset = uint32_t(t->offset);
+            in.a = t->mask;
+            in.b = t->value;
+            rest.push_back(in);
+            break;
+        case OP_RANGE:
+            if (t->field.bitSize < 1 || t->field.bitSize > 32 || t->min > t->max)
+                return false;
+            if (!require(0, 0xff, t->field.reportId))
+                return false;
+            in.size = (unsigned char)t->field.bitSize;
+            in.isSigned = t->field.isSigned;
+            in.offset = t->field.bitOffset;
+            in.a = uint64_t(t->min);
+            in.b = uint64_t(t->max);
+            rest.push_back(in);
+            break;
+        }
+    }
+
+    /* Masked equality of neighbouring bytes becomes one compare per word */
+    for (auto it = equal.begin(); it != equal.end();) {
+        if (!it->second.first) {
+            ++it;
+            continue;
+        }
+        Instr in = Instr();
+        in.op = OP_EQUAL;
+        in.offset = uint32_t(it->first);
+        for (; it != equal.end() && it->first < in.offset + WORD_BYTES; ++it) {
+            if (!it->second.first)
+                continue;
+            unsigned int shift = 8 * unsigned(it->first - in.offset);
+            in.a |= uint64_t(it->second.first) << shift;
+            in.b |= uint64_t(it->second.second) << shift;
+            in.size = (unsigned char)(it->first - in.offset + 1);
+        }
+        out.push_back(in);
+    }
+
+    /* Single byte tests before field decoding */
+    std::stable_sort(rest.begin(), rest.end(), [](const Instr &x, const Instr &y){return x.op < y.op;});
+    out.insert(out.end(), rest.begin(), rest.end());
+    return true;
+}
+
+bool ReportPredicate::matches(const unsigned char *report, size_t length) const
+{
+    size_t n = m_program.size();
+    if (!n)
+        return m_matchAll;
+
+    for (size_t i = 0; i < n;) {
+        const Instr &in = m_program[i];
+        bool ok;
+        switch (in.op) {
+        case OP_EQUAL:
+            ok = in.offset + in.size <= length
+                    && (load(report, length, in.offset, in.size) & in.a) == in.b;
+            break;
+        case OP_NOT_EQUAL:
+            ok = in.offset < length && (report[in.offset] & in.a) != in.b;
+            break;
+        default: {
+            size_t first = in.offset / 8;
+            unsigned int shift = in.offset % 8;
+            size_t bytes = (shift + in.size + 7) / 8;
+            if (first + bytes > length) {
+                ok = false;
+                break;
+            }
+            uint64_t v = (load(report, length, first, bytes) >> shift) & ((uint64_t(1) << in.size) - 1);
+            int64_t value = int64_t(v);
+            if (in.isSigned && (v >> (in.size - 1)))
+                value -= int64_t(1) << in.size;
+            ok = value >= int64_t(in.a) && value <= int64_t(in.b);
+            break;
+        }
+        }
+
+        if (!ok)
+            i = in.next;
+        else if (in.last)
+            return true;
+        else
+            i++;
+    }
+    return false;
+}
@@ -0,0 +1,248 @@
+#include "reportpublisher.h"
+
+#include <algorithm>
+#include <cstring>
+
+/* Bytes per slot including its header, keeps slots 8-byte aligned */
+static size_t slotStride(size_t slotSize)
+{
+    return sizeof(ReportRingSlot) + ((slotSize + 7) & ~(size_t)7);
+}
+
+ReportPublisher::~ReportPublisher()
+{
+    if (m_header)
+        UnmapViewOfFile(m_header);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+}
+
+bool ReportPublisher::create(const std::wstring &name, size_t slotSize, size_t slotCount)
+{
+    if (m_header || slotSize == 0 || slotCount == 0)
+        return false;
+
+    m_stride = slotStride(slotSize);
+    unsigned long long size = sizeof(ReportRingHeader) + (unsigned long long)m_stride * slotCount;
+
+    m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                   (DWORD)(size >> 32), (DWORD)size, name.c_str());
+    if (m_mapping == NULL)
+        return false;
+    /* Another publisher, or subscribers of a previous one, still hold the
+     * name. Rewriting the geometry under them would misplace their reads. */
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return false;
+    }
+
+    m_header = (ReportRingHeader*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (m_header == nullptr) {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return false;
+    }
+    m_slots = (unsigned char*)m_header + sizeof(ReportRingHeader);
+    m_name = name;
+
+    /* A fresh mapping is zero filled, which is a valid empty ring apart from
+     * the geometry. The magic is written last so subscribers never see a
+     * half initialized header. */
+    m_header->version = REPORT_RING_VERSION;
+    m_header->slotSize = (uint32_t)slotSize;
+    m_header->slotCount = (uint32_t)slotCount;
+    m_header->writeSeq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = REPORT_RING_MAGIC;
+    return true;
+}
+
+void ReportPublisher::publish(const unsigned char *report, size_t length, uint64_t timestamp)
+{
+    if (m_header == nullptr)
+        return;
+
+    uint64_t n = m_header->writeSeq.load(std::memory_order_relaxed);
+    ReportRingSlot *slot = (ReportRingSlot*)(m_slots + (n % m_header->slotCount) * m_stride);
+
+    slot->seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    length = std::min<size_t>(length, m_header->slotSize);
+    slot->timestamp = timestamp;
+    slot->length = (uint32_t)length;
+    memcpy((unsigned char*)slot + sizeof(ReportRingSlot), report, length);
+
+    slot->seq.store(2 * n + 2, std::memory_order_release);
+    m_header->writeSeq.store(n + 1, std::memory_order_release);
+}
+
+uint64_t ReportPublisher::published() const
+{
+    return m_header ? m_header->writeSeq.load(std::memory_order_acquire) : 0;
+}
+
+std::vector<ReportPublisher::Lag> ReportPublisher::lags() const
+{
+    std::vector<Lag> res;
+    if (m_header == nullptr)
+        return res;
+
+    uint64_t written = published();
+    for (auto &s : m_header->subscribers) {
+        uint32_t pid = s.pid.load(std::memory_order_acquire);
+        if (pid == 0)
+            continue;
+        uint64_t position = s.position.load(std::memory_order_relaxed);
+        res.push_back(Lag{pid, written > position ? written - position : 0});
+    }
+    return res;
+}
+
+ReportSubscriber::~ReportSubscriber()
+{
+    if (m_entry)
+        m_entry->pid.store(0, std::memory_order_release);
+    if (m_header)
+        UnmapViewOfFile(m_header);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+}
+
+bool ReportSubscriber::open(const std::wstring &name)
+{
+    if (m_header)
+        return false;
+
+    m_mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (m_mapping == NULL)
+        return false;
+
+    m_header = (ReportRingHeader*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (m_header == nullptr || m_header->magic != REPORT_RING_MAGIC
+            || m_header->version != REPORT_RING_VERSION) {
+        if (m_header)
+            UnmapViewOfFile(m_header);
+        m_header = nullptr;
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_slots = (unsigned char*)m_header + sizeof(ReportRingHeader);
+    m_stride = slotStride(m_header->slotSize);
+    m_position = m_header->writeSeq.load(std::memory_order_acquire);
+
+    /* Claim an entry so the publisher can see our lag */
+    for (auto &s : m_header->subscribers) {
+        uint32_t free = 0;
+        if (s.pid.compare_exchange_strong(free, GetCurrentProcessId())) {
+            s.position.store(m_position, std::memory_order_relaxed);
+            m_entry = &s;
+            return true;
+        }
+    }
+    return false;
+}
+
+ReportRingSlot *ReportSubscriber::next()
+{
+    if (m_header == nullptr)
+        return nullptr;
+
+    uint64_t written = m_header->writeSeq.load(std::memory_order_acquire);
+    if (m_position >= written)
+        return nullptr;
+
+    /* Reports older than one ring length have been overwritten */
+    if (written - m_position > m_header->slotCount) {
+        m_lost += written - m_position - m_header->slotCount;
+        m_position = written - m_header->slotCount;
+    }
+    return (ReportRingSlot*)(m_slots + (m_position % m_header->slotCount) * m_stride);
+}
+
+bool ReportSubscriber::poll(unsigned char *buf, size_t &length, uint64_t *timestamp)
+{
+    while (true) {
+        ReportRingSlot *slot = next();
+        if (slot == nullptr)
+            return false;
+
+        uint64_t expected = 2 * m_position + 2;
+        uint64_t before = slot->seq.load(std::memory_order_acquire);
+        if (before == expected) {
+            size_t len = slot->length;
+            uint64_t ts = slot->timestamp;
+            memcpy(buf, (unsigned char*)slot + sizeof(ReportRingSlot), len);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == expected) {
+                length = len;
+                if (timestamp)
+                    *timestamp = ts;
+                m_position++;
+                if (m_entry)
+                    m_entry->position.store(m_position, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        /* Overwritten while copying, or before we got to it: the next call
+         * to next() skips ahead. */
+        if (before > expected || slot->seq.load(std::memory_order_relaxed) > expected) {
+            m_lost++;
+            m_position++;
+            continue;
+        }
+        return false;
+    }
+}
+
+bool ReportSubscriber::peek(const unsigned char *&data, size_t &length, uint64_t *timestamp)
+{
+    ReportRingSlot *slot;
+    while ((slot = next()) != nullptr) {
+        uint64_t expected = 2 * m_position + 2;
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq < expected)
+            return false;
+        if (seq > expected) {
+            m_lost++;
+            m_position++;
+            continue;
+        }
+
+        m_peekSeq = seq;
+        data = (unsigned char*)slot + sizeof(ReportRingSlot);
+        length = slot->length;
+        if (timestamp)
+            *timestamp = slot->timestamp;
+        return true;
+    }
+    return false;
+}
+
+bool ReportSubscriber::commit()
+{
+    if (m_header == nullptr)
+        return false;
+
+    ReportRingSlot *slot = (ReportRingSlot*)(m_slots + (m_position % m_header->slotCount) * m_stride);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool valid = slot->seq.load(std::memory_order_relaxed) == m_peekSeq;
+    if (!valid)
+        m_lost++;
+
+    m_position++;
+    if (m_entry)
+        m_entry->position.store(m_position, std::memory_order_relaxed);
+    return valid;
+}
+
+uint64_t ReportSubscriber::lag() const
+{
+    if (m_header == nullptr)
+        return 0;
+    uint64_t written = m_header->writeSeq.load(std::memory_order_acquire);
+    return written > m_position ? written - m_position : 0;
+}
@@ -0,0 +1,166 @@
+#include "reportqueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+ReportQueue::ReportQueue(size_t depth, size_t reportLength, OverflowPolicy policy) :
+    m_data(std::max<size_t>(depth, 1) * reportLength),
+    m_lengths(std::max<size_t>(depth, 1)),
+    m_depth(std::max<size_t>(depth, 1)),
+    m_reportLength(reportLength),
+    m_policy(policy)
+{
+    m_slotOfId.fill(-1);
+}
+
+bool ReportQueue::push(const unsigned char *report, size_t length)
+{
+    if (length > m_reportLength)
+        length = m_reportLength;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_closed)
+        return false;
+
+    /* A report with the same ID still waiting to be dispatched is simply
+     * replaced, the consumer only cares about the latest one. */
+    if (m_policy == OverflowPolicy::KeepLatest && length > 0 && m_slotOfId[report[0]] >= 0) {
+        size_t slot = m_slotOfId[report[0]];
+        memcpy(&m_data[slot * m_reportLength], report, length);
+        m_lengths[slot] = length;
+        m_dropped++;
+        return true;
+    }
+
+    /* Loops if the policy changes from Block while waiting */
+    while (m_count == m_depth) {
+        switch (m_policy) {
+        case OverflowPolicy::Block:
+            m_notFull.wait(lock, [this](){return m_count < m_depth || m_closed || m_policy != OverflowPolicy::Block;});
+            if (m_closed)
+                return false;
+            break;
+        case OverflowPolicy::DropNewest:
+            m_dropped++;
+            return false;
+        case OverflowPolicy::DropOldest:
+        case OverflowPolicy::KeepLatest:
+            popHead();
+            m_dropped++;
+            break;
+        }
+    }
+
+    size_t slot = (m_head + m_count) % m_depth;
+    memcpy(&m_data[slot * m_reportLength], report, length);
+    m_lengths[slot] = length;
+    if (m_policy == OverflowPolicy::KeepLatest && length > 0)
+        m_slotOfId[report[0]] = slot;
+    m_count++;
+
+    lock.unlock();
+    m_notEmpty.notify_one();
+    return true;
+}
+
+bool ReportQueue::pop(unsigned char *report, size_t &length)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this](){return m_count > 0 || m_closed;});
+    if (m_count == 0)
+        return false;
+
+    length = m_lengths[m_head];
+    memcpy(report, &m_data[m_head * m_reportLength], length);
+    popHead();
+
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+}
+
+void ReportQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+}
+
+unsigned long long ReportQueue::dropped()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+size_t ReportQueue::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_count;
+}
+
+void ReportQueue::setDepth(size_t depth)
+{
+    depth = std::max<size_t>(depth, 1);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (depth == m_depth)
+            return;
+
+        /* Keep the newest reports that fit, oldest first */
+        size_t keep = std::min(m_count, depth);
+        m_dropped += m_count - keep;
+        std::vector<unsigned char> data(depth * m_reportLength);
+        std::vector<size_t> lengths(depth);
+        for (size_t i = 0; i < keep; i++) {
+            size_t slot = (m_head + m_count - keep + i) % m_depth;
+            memcpy(&data[i * m_reportLength], &m_data[slot * m_reportLength], m_lengths[slot]);
+            lengths[i] = m_lengths[slot];
+        }
+
+        m_data.swap(data);
+        m_lengths.swap(lengths);
+        m_depth = depth;
+        m_head = 0;
+        m_count = keep;
+        indexIds();
+    }
+    m_notFull.notify_all();
+}
+
+void ReportQueue::setPolicy(OverflowPolicy policy)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (policy == m_policy)
+            return;
+        m_policy = policy;
+        indexIds();
+    }
+    m_notFull.notify_all();
+}
+
+void ReportQueue::indexIds()
+{
+    m_slotOfId.fill(-1);
+    if (m_policy != OverflowPolicy::KeepLatest)
+        return;
+    for (size_t i = 0; i < m_count; i++) {
+        size_t slot = (m_head + i) % m_depth;
+        if (m_lengths[slot] > 0)
+            m_slotOfId[m_data[slot * m_reportLength]] = int(slot);
+    }
+}
+
+void ReportQueue::popHead()
+{
+    if (m_policy == OverflowPolicy::KeepLatest && m_lengths[m_head] > 0) {
+        unsigned char id = m_data[m_head * m_reportLength];
+        if (m_slotOfId[id] == (int)m_head)
+            m_slotOfId[id] = -1;
+    }
+    m_head = (m_head + 1) % m_depth;
+    m_count--;
+}
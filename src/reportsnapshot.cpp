@@ -0,0 +1,77 @@
+#include "reportsnapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+ReportSnapshot::ReportSnapshot(size_t reportLength) :
+    m_reportLength(reportLength),
+    m_words((reportLength + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+{
+    for (auto &s : m_slots)
+        s.store(nullptr, std::memory_order_relaxed);
+}
+
+ReportSnapshot::~ReportSnapshot()
+{
+    for (auto &s : m_slots)
+        delete s.load(std::memory_order_relaxed);
+}
+
+void ReportSnapshot::update(const unsigned char *report, size_t length)
+{
+    if (length == 0)
+        return;
+    length = std::min(length, m_reportLength);
+
+    Slot *slot = m_slots[report[0]].load(std::memory_order_relaxed);
+    if (slot == nullptr) {
+        slot = new Slot;
+        slot->seq.store(0, std::memory_order_relaxed);
+        slot->length.store(0, std::memory_order_relaxed);
+        slot->words.reset(new std::atomic<uint64_t>[m_words]);
+        for (size_t i = 0; i < m_words; i++)
+            slot->words[i].store(0, std::memory_order_relaxed);
+        m_slots[report[0]].store(slot, std::memory_order_release);
+    }
+
+    unsigned long long seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0, offset = 0; offset < length; i++, offset += sizeof(uint64_t)) {
+        uint64_t w = 0;
+        memcpy(&w, report + offset, std::min(sizeof(uint64_t), length - offset));
+        slot->words[i].store(w, std::memory_order_relaxed);
+    }
+    slot->length.store(length, std::memory_order_relaxed);
+
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool ReportSnapshot::read(unsigned char id, unsigned char *report, size_t &length,
+                          unsigned long long *sequence) const
+{
+    const Slot *slot = m_slots[id].load(std::memory_order_acquire);
+    if (slot == nullptr)
+        return false;
+
+    unsigned long long before, after;
+    do {
+        before = slot->seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        length = slot->length.load(std::memory_order_relaxed);
+        for (size_t i = 0, offset = 0; offset < length; i++, offset += sizeof(uint64_t)) {
+            uint64_t w = slot->words[i].load(std::memory_order_relaxed);
+            memcpy(report + offset, &w, std::min(sizeof(uint64_t), length - offset));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot->seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    if (sequence)
+        *sequence = before / 2;
+    return true;
+}
@@ -0,0 +1,123 @@
+#include "roundtripprobe.h"
+#include "hidclock.h"
+#include "hiddevice.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+static bool slower(const RoundTripOutlier &a, const RoundTripOutlier &b)
+{
+    return a.latency > b.latency;
+}
+
+RoundTripProbe::RoundTripProbe()
+{
+    /* Start somewhere else every time so that stale replies of an
+     * earlier run do not match */
+    m_nextTag = uint32_t(HidClock::now() >> 10) | 1;
+}
+
+bool RoundTripProbe::run(HidDevice &device, unsigned long count)
+{
+    if (m_report.size() < m_outputOffset + 4)
+        return false;
+
+    std::vector<unsigned char> report = m_report;
+    bool ok = true;
+    device.setProbe(this);
+
+    for (unsigned long i = 0; i < count; i++) {
+        uint32_t tag = m_nextTag++;
+        if (!tag)
+            tag = m_nextTag++;
+        for (int b = 0; b < 4; b++)
+            report[m_outputOffset + b] = (unsigned char)(tag >> (8 * b));
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pendingTag = tag;
+            m_matched = false;
+            m_sent = HidClock::now();
+        }
+        if (!device.submitWrite(report.data(), report.size())) {
+            ok = false;
+            break;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_replied.wait_for(lock, std::chrono::milliseconds(m_timeoutMs), [this](){return m_matched;}))
+                m_timeouts++;
+            m_pendingTag = 0;
+        }
+        if (!device.waitSubmitted(TIMEOUT)) {
+            ok = false;
+            break;
+        }
+
+        if (m_intervalUs)
+            std::this_thread::sleep_for(std::chrono::microseconds(m_intervalUs));
+    }
+
+    device.setProbe(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingTag = 0;
+    }
+    return ok;
+}
+
+void RoundTripProbe::received(const unsigned char *report, size_t length, uint64_t time)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t tag = 0;
+    if (length >= m_inputOffset + 4)
+        for (int b = 0; b < 4; b++)
+            tag |= uint32_t(report[m_inputOffset + b]) << (8 * b);
+
+    if (!m_pendingTag || tag != m_pendingTag || m_matched) {
+        m_unmatched++;
+        return;
+    }
+
+    uint64_t latency = time > m_sent ? time - m_sent : 0;
+    m_histogram.record(latency);
+    m_matched = true;
+
+    if (m_outlierCount) {
+        RoundTripOutlier o = {tag, m_sent, latency};
+        if (m_outliers.size() < m_outlierCount) {
+            m_outliers.push_back(o);
+            std::push_heap(m_outliers.begin(), m_outliers.end(), slower);
+        } else if (latency > m_outliers.front().latency) {
+            std::pop_heap(m_outliers.begin(), m_outliers.end(), slower);
+            m_outliers.back() = o;
+            std::push_heap(m_outliers.begin(), m_outliers.end(), slower);
+        }
+    }
+    m_replied.notify_one();
+}
+
+void RoundTripProbe::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_histogram.reset();
+    m_outliers.clear();
+    m_timeouts = 0;
+    m_unmatched = 0;
+}
+
+std::vector<RoundTripOutlier> RoundTripProbe::outliers()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<RoundTripOutlier> sorted = m_outliers;
+    std::sort(sorted.begin(), sorted.end(), slower);
+    return sorted;
+}
+
+unsigned long long RoundTripProbe::unmatched()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_unmatched;
+}
@@ -0,0 +1,134 @@
+#include "simulateddevice.h"
+#include "hidclock.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+SimulatedDevice::SimulatedDevice(const std::wstring &path, size_t inputReportLength, size_t outputReportLength) :
+    m_path(path),
+    m_inputReportLength(std::max<size_t>(inputReportLength, 1)),
+    m_outputReportLength(std::max<size_t>(outputReportLength, 1))
+{
+    /* Registry keys are lower case like system device paths */
+    std::transform(m_path.begin(), m_path.end(), m_path.begin(), tolower);
+}
+
+void SimulatedDevice::setEcho(bool a, unsigned long delayUs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_echo = a;
+    m_echoDelayNs = uint64_t(delayUs) * 1000;
+}
+
+void SimulatedDevice::setInputBuffers(size_t n)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_inputBuffers = std::max<size_t>(n, 1);
+}
+
+void SimulatedDevice::push(const unsigned char *report, size_t length, uint64_t due)
+{
+    Pending p;
+    p.due = due;
+    p.seq = m_seq++;
+    p.report.assign(m_inputReportLength, 0);
+    memcpy(p.report.data(), report, std::min(length, m_inputReportLength));
+    m_input.push(std::move(p));
+
+    /* Like the HID class driver ring, drop the oldest report when full */
+    while (m_input.size() > m_inputBuffers) {
+        m_input.pop();
+        m_dropped++;
+    }
+    m_inputReady.notify_one();
+    if (m_listener)
+        m_listener();
+}
+
+void SimulatedDevice::take(unsigned char *buf, size_t &length, uint64_t *due)
+{
+    const std::vector<unsigned char> &report = m_input.top().report;
+    memcpy(buf, report.data(), report.size());
+    length = report.size();
+    if (due)
+        *due = m_input.top().due;
+    m_input.pop();
+}
+
+void SimulatedDevice::inject(const unsigned char *report, size_t length, unsigned long delayUs)
+{
+    uint64_t due = HidClock::now() + uint64_t(delayUs) * 1000;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    push(report, length, due);
+}
+
+bool SimulatedDevice::read(unsigned char *buf, size_t &length, unsigned long timeout, uint64_t *due)
+{
+    uint64_t interval = uint64_t(timeout) * 1000000;
+    uint64_t deadline = HidClock::now() + interval;
+    uint64_t realDeadline = HidClock::steady() + interval;
+    /* Created before locking m_mutex, the clock's lock orders before it, see HidClock::Listener */
+    HidClock::Listener listener([this](){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inputReady.notify_all();
+    });
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        uint64_t now = HidClock::now();
+        if (!m_input.empty() && m_input.top().due <= now)
+            break;
+        uint64_t real = HidClock::steady();
+        if (now >= deadline || real >= realDeadline)
+            return false;
+
+        uint64_t wake = deadline;
+        if (!m_input.empty())
+            wake = std::min(wake, m_input.top().due);
+        m_inputReady.wait_for(lock, std::chrono::nanoseconds(std::min(wake - now, realDeadline - real)));
+    }
+
+    take(buf, length, due);
+    return true;
+}
+
+bool SimulatedDevice::poll(unsigned char *buf, size_t &length, uint64_t &next, uint64_t *due)
+{
+    uint64_t now = HidClock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool ready = !m_input.empty() && m_input.top().due <= now;
+    if (ready)
+        take(buf, length, due);
+    next = m_input.empty() ? UINT64_MAX : m_input.top().due;
+    return ready;
+}
+
+void SimulatedDevice::setListener(std::function<void()> cb)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listener = cb;
+}
+
+bool SimulatedDevice::write(const void *report, size_t length)
+{
+    uint64_t now = HidClock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_written++;
+    if (m_echo)
+        push((const unsigned char*)report, std::min(length, m_outputReportLength), now + m_echoDelayNs);
+    return true;
+}
+
+unsigned long long SimulatedDevice::written()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_written;
+}
+
+unsigned long long SimulatedDevice::dropped()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
@@ -0,0 +1,62 @@
+#include "writecoalescer.h"
+
+WriteCoalescer::WriteCoalescer(std::function<bool(const unsigned char*, size_t)> send) :
+    m_send(send)
+{
+    m_thread = std::thread([this](){this->run();});
+}
+
+WriteCoalescer::~WriteCoalescer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void WriteCoalescer::post(unsigned int key, const unsigned char *report, size_t length)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Pending &p = m_pending[key];
+        p.data.assign(report, report + length);
+        if (p.queued) {
+            m_coalesced++;
+            return;
+        }
+        p.queued = true;
+        m_order.push_back(key);
+    }
+    m_cv.notify_one();
+}
+
+unsigned long long WriteCoalescer::coalesced()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_coalesced;
+}
+
+void WriteCoalescer::run()
+{
+    std::vector<unsigned char> sending;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_cv.wait(lock, [this](){return m_stopping || !m_order.empty();});
+        if (m_stopping)
+            return;
+
+        Pending &p = m_pending[m_order.front()];
+        m_order.pop_front();
+        sending.assign(p.data.begin(), p.data.end());
+        p.queued = false;
+
+        /* Posting continues while the device is busy */
+        lock.unlock();
+        m_send(sending.data(), sending.size());
+        lock.lock();
+    }
+}
@@ -4,8 +4,58 @@
 
 INCLUDEPATH += $$PWD/include
 
-SOURCES     += $$PWD/src/hidapi.cpp $$PWD/src/hiddevice.cpp
-HEADERS     += $$PWD/include/hidapi.h $$PWD/include/hiddevice.h
+SOURCES     += $$PWD/src/hidapi.cpp $$PWD/src/hiddevice.cpp \
+               $$PWD/src/reportqueue.cpp \
+               $$PWD/src/reportsnapshot.cpp \
+               $$PWD/src/changefilter.cpp \
+               $$PWD/src/outputscheduler.cpp \
+               $$PWD/src/writecoalescer.cpp \
+               $$PWD/src/hotplugpipeline.cpp \
+               $$PWD/src/hotplugsource.cpp \
+               $$PWD/src/reportpublisher.cpp \
+               $$PWD/src/hidprotocol.cpp \
+               $$PWD/src/hidserver.cpp \
+               $$PWD/src/hidclient.cpp \
+               $$PWD/src/callbackexecutor.cpp \
+               $$PWD/src/reportfield.cpp \
+               $$PWD/src/reportaggregator.cpp \
+               $$PWD/src/hidtrace.cpp \
+               $$PWD/src/simulateddevice.cpp \
+               $$PWD/src/latencyhistogram.cpp \
+               $$PWD/src/roundtripprobe.cpp \
+               $$PWD/src/reportformatter.cpp \
+               $$PWD/src/reportlogger.cpp \
+               $$PWD/src/reportarchive.cpp \
+               $$PWD/src/devicetable.cpp \
+               $$PWD/src/hiddevicegroup.cpp \
+               $$PWD/src/hidclock.cpp \
+               $$PWD/src/reportpredicate.cpp
+HEADERS     += $$PWD/include/hidapi.h $$PWD/include/hiddevice.h \
+               $$PWD/include/reportqueue.h \
+               $$PWD/include/reportsnapshot.h \
+               $$PWD/include/changefilter.h \
+               $$PWD/include/hidclock.h \
+               $$PWD/include/outputscheduler.h \
+               $$PWD/include/writecoalescer.h \
+               $$PWD/include/hotplugpipeline.h \
+               $$PWD/include/hotplugsource.h \
+               $$PWD/include/reportpublisher.h \
+               $$PWD/include/hidprotocol.h \
+               $$PWD/include/hidserver.h \
+               $$PWD/include/hidclient.h \
+               $$PWD/include/callbackexecutor.h \
+               $$PWD/include/reportfield.h \
+               $$PWD/include/reportaggregator.h \
+               $$PWD/include/hidtrace.h \
+               $$PWD/include/simulateddevice.h \
+               $$PWD/include/latencyhistogram.h \
+               $$PWD/include/roundtripprobe.h \
+               $$PWD/include/reportformatter.h \
+               $$PWD/include/reportlogger.h \
+               $$PWD/include/reportarchive.h \
+               $$PWD/include/devicetable.h \
+               $$PWD/include/hiddevicegroup.h \
+               $$PWD/include/reportpredicate.h
 
 CONFIG      += c++11
-LIBS        += -lsetupapi -lhid
+LIBS        += -lsetupapi -lhid -lcfgmgr32 -lws2_32